@@ -0,0 +1,31 @@
+// Times RParquet_Reader without the R wrapper: planning (footer, selection
+// and row group pruning) and decoding are reported separately. Built from
+// the source tree by bench_rparquet.R with Rcpp::sourceCpp().
+// [[Rcpp::plugins(cpp14)]]
+#include "../src/rcpp_rparquet_reader.cpp"
+#include "bench_util.h"
+
+// [[Rcpp::export]]
+DataFrame bench_reader_cpp(std::string filename, IntegerVector selected_col, List where, bool as_factor,
+                           int threads, int reps) {
+  NumericVector init_sec(reps);
+  NumericVector read_sec(reps);
+  NumericVector rows(reps);
+  NumericVector peak_rss(reps);
+  for (int rep = 0; rep < reps; ++rep) {
+    RParquet::RParquet_Reader rp_reader(filename, selected_col, LogicalVector::create(TRUE), where,
+                                        NumericVector(), NumericVector(), as_factor, 100000, threads,
+                                        List(), false, 0);
+    auto start = std::chrono::steady_clock::now();
+    rp_reader.init();
+    init_sec[rep] = RParquet_Bench::seconds_since(start);
+    start = std::chrono::steady_clock::now();
+    SEXP df = PROTECT(rp_reader.create_df());
+    read_sec[rep] = RParquet_Bench::seconds_since(start);
+    UNPROTECT(1);
+    rows[rep] = rp_reader.selected_rows();
+    peak_rss[rep] = RParquet_Bench::peak_rss_bytes();
+  }
+  return DataFrame::create(Named("init_sec") = init_sec, Named("read_sec") = read_sec,
+                           Named("rows") = rows, Named("peak_rss") = peak_rss);
+}
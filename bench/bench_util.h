@@ -0,0 +1,28 @@
+#ifndef RPARQUET_BENCH_UTIL_H
+#define RPARQUET_BENCH_UTIL_H
+
+#include <chrono>
+#include <sys/resource.h>
+
+namespace RParquet_Bench {
+
+inline double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Peak resident set size of the process so far, in bytes.
+inline double peak_rss_bytes() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#if defined(__APPLE__)
+  return static_cast<double>(usage.ru_maxrss);
+#else
+  return static_cast<double>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+} // namespace RParquet_Bench
+
+#endif // RPARQUET_BENCH_UTIL_H
@@ -0,0 +1,25 @@
+// Times Rparquet_Writer without the R wrapper, from opening the file to
+// closing it. Built from the source tree by bench_rparquet.R with
+// Rcpp::sourceCpp().
+// [[Rcpp::plugins(cpp14)]]
+#include "../src/rcpp_rparquet_writer.cpp"
+#include "bench_util.h"
+
+// [[Rcpp::export]]
+DataFrame bench_writer_cpp(DataFrame df, std::string filename, CharacterVector col_types, int group_rows,
+                           int threads, List options, int reps) {
+  NumericVector write_sec(reps);
+  NumericVector peak_rss(reps);
+  for (int rep = 0; rep < reps; ++rep) {
+    auto start = std::chrono::steady_clock::now();
+    RParquet::Rparquet_Writer rp_writer(filename, IntegerVector::create(-1), group_rows, threads, options, false, 0);
+    if (!rp_writer.init(df, col_types)) {
+      stop("Unsupported column type");
+    }
+    rp_writer.write_parquet(df, col_types);
+    rp_writer.close();
+    write_sec[rep] = RParquet_Bench::seconds_since(start);
+    peak_rss[rep] = RParquet_Bench::peak_rss_bytes();
+  }
+  return DataFrame::create(Named("write_sec") = write_sec, Named("peak_rss") = peak_rss);
+}
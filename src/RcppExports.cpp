@@ -6,36 +6,156 @@
 using namespace Rcpp;
 
 // read_parquet
-List read_parquet(std::string filename, IntegerVector selected_col, LogicalVector filter, int read_row_size, int threads, int verbose);
-RcppExport SEXP _RParquet_read_parquet(SEXP filenameSEXP, SEXP selected_colSEXP, SEXP filterSEXP, SEXP read_row_sizeSEXP, SEXP threadsSEXP, SEXP verboseSEXP) {
+List read_parquet(std::string filename, IntegerVector selected_col, LogicalVector filter, List where, NumericVector row_from, NumericVector row_to, bool as_factor, int read_row_size, int threads, List io_options, bool lazy, bool profile, int verbose);
+RcppExport SEXP _RParquet_read_parquet(SEXP filenameSEXP, SEXP selected_colSEXP, SEXP filterSEXP, SEXP whereSEXP, SEXP row_fromSEXP, SEXP row_toSEXP, SEXP as_factorSEXP, SEXP read_row_sizeSEXP, SEXP threadsSEXP, SEXP io_optionsSEXP, SEXP lazySEXP, SEXP profileSEXP, SEXP verboseSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< std::string >::type filename(filenameSEXP);
     Rcpp::traits::input_parameter< IntegerVector >::type selected_col(selected_colSEXP);
     Rcpp::traits::input_parameter< LogicalVector >::type filter(filterSEXP);
+    Rcpp::traits::input_parameter< List >::type where(whereSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type row_from(row_fromSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type row_to(row_toSEXP);
+    Rcpp::traits::input_parameter< bool >::type as_factor(as_factorSEXP);
     Rcpp::traits::input_parameter< int >::type read_row_size(read_row_sizeSEXP);
     Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< List >::type io_options(io_optionsSEXP);
+    Rcpp::traits::input_parameter< bool >::type lazy(lazySEXP);
+    Rcpp::traits::input_parameter< bool >::type profile(profileSEXP);
     Rcpp::traits::input_parameter< int >::type verbose(verboseSEXP);
-    rcpp_result_gen = Rcpp::wrap(read_parquet(filename, selected_col, filter, read_row_size, threads, verbose));
+    rcpp_result_gen = Rcpp::wrap(read_parquet(filename, selected_col, filter, where, row_from, row_to, as_factor, read_row_size, threads, io_options, lazy, profile, verbose));
+    return rcpp_result_gen;
+END_RCPP
+}
+// open_parquet
+SEXP open_parquet(std::string filename, IntegerVector selected_col, LogicalVector filter, List where, NumericVector row_from, NumericVector row_to, bool as_factor, int read_row_size, int threads, List io_options, bool profile, int verbose);
+RcppExport SEXP _RParquet_open_parquet(SEXP filenameSEXP, SEXP selected_colSEXP, SEXP filterSEXP, SEXP whereSEXP, SEXP row_fromSEXP, SEXP row_toSEXP, SEXP as_factorSEXP, SEXP read_row_sizeSEXP, SEXP threadsSEXP, SEXP io_optionsSEXP, SEXP profileSEXP, SEXP verboseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type filename(filenameSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type selected_col(selected_colSEXP);
+    Rcpp::traits::input_parameter< LogicalVector >::type filter(filterSEXP);
+    Rcpp::traits::input_parameter< List >::type where(whereSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type row_from(row_fromSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type row_to(row_toSEXP);
+    Rcpp::traits::input_parameter< bool >::type as_factor(as_factorSEXP);
+    Rcpp::traits::input_parameter< int >::type read_row_size(read_row_sizeSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< List >::type io_options(io_optionsSEXP);
+    Rcpp::traits::input_parameter< bool >::type profile(profileSEXP);
+    Rcpp::traits::input_parameter< int >::type verbose(verboseSEXP);
+    rcpp_result_gen = Rcpp::wrap(open_parquet(filename, selected_col, filter, where, row_from, row_to, as_factor, read_row_size, threads, io_options, profile, verbose));
+    return rcpp_result_gen;
+END_RCPP
+}
+// read_parquet_batch
+SEXP read_parquet_batch(SEXP reader, int batch_rows);
+RcppExport SEXP _RParquet_read_parquet_batch(SEXP readerSEXP, SEXP batch_rowsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type reader(readerSEXP);
+    Rcpp::traits::input_parameter< int >::type batch_rows(batch_rowsSEXP);
+    rcpp_result_gen = Rcpp::wrap(read_parquet_batch(reader, batch_rows));
+    return rcpp_result_gen;
+END_RCPP
+}
+// read_parquet_dataset
+List read_parquet_dataset(CharacterVector filenames, IntegerVector selected_col, List where, bool as_factor, int threads, List io_options, int verbose);
+RcppExport SEXP _RParquet_read_parquet_dataset(SEXP filenamesSEXP, SEXP selected_colSEXP, SEXP whereSEXP, SEXP as_factorSEXP, SEXP threadsSEXP, SEXP io_optionsSEXP, SEXP verboseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type filenames(filenamesSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type selected_col(selected_colSEXP);
+    Rcpp::traits::input_parameter< List >::type where(whereSEXP);
+    Rcpp::traits::input_parameter< bool >::type as_factor(as_factorSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< List >::type io_options(io_optionsSEXP);
+    Rcpp::traits::input_parameter< int >::type verbose(verboseSEXP);
+    rcpp_result_gen = Rcpp::wrap(read_parquet_dataset(filenames, selected_col, where, as_factor, threads, io_options, verbose));
     return rcpp_result_gen;
 END_RCPP
 }
 // read_metadata
-DataFrame read_metadata(std::string filename, bool details);
-RcppExport SEXP _RParquet_read_metadata(SEXP filenameSEXP, SEXP detailsSEXP) {
+DataFrame read_metadata(std::string filename, bool details, bool profile);
+RcppExport SEXP _RParquet_read_metadata(SEXP filenameSEXP, SEXP detailsSEXP, SEXP profileSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< std::string >::type filename(filenameSEXP);
     Rcpp::traits::input_parameter< bool >::type details(detailsSEXP);
-    rcpp_result_gen = Rcpp::wrap(read_metadata(filename, details));
+    Rcpp::traits::input_parameter< bool >::type profile(profileSEXP);
+    rcpp_result_gen = Rcpp::wrap(read_metadata(filename, details, profile));
+    return rcpp_result_gen;
+END_RCPP
+}
+// read_stats
+DataFrame read_stats(CharacterVector filenames, int threads);
+RcppExport SEXP _RParquet_read_stats(SEXP filenamesSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type filenames(filenamesSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(read_stats(filenames, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// read_aggregate
+DataFrame read_aggregate(std::string filename, CharacterVector columns, CharacterVector funs, List where, CharacterVector by, int threads, List io_options, int verbose);
+RcppExport SEXP _RParquet_read_aggregate(SEXP filenameSEXP, SEXP columnsSEXP, SEXP funsSEXP, SEXP whereSEXP, SEXP bySEXP, SEXP threadsSEXP, SEXP io_optionsSEXP, SEXP verboseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type filename(filenameSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type columns(columnsSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type funs(funsSEXP);
+    Rcpp::traits::input_parameter< List >::type where(whereSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type by(bySEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< List >::type io_options(io_optionsSEXP);
+    Rcpp::traits::input_parameter< int >::type verbose(verboseSEXP);
+    rcpp_result_gen = Rcpp::wrap(read_aggregate(filename, columns, funs, where, by, threads, io_options, verbose));
+    return rcpp_result_gen;
+END_RCPP
+}
+// metadata_cache_info
+List metadata_cache_info();
+RcppExport SEXP _RParquet_metadata_cache_info() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(metadata_cache_info());
+    return rcpp_result_gen;
+END_RCPP
+}
+// metadata_cache_clear
+int metadata_cache_clear();
+RcppExport SEXP _RParquet_metadata_cache_clear() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(metadata_cache_clear());
+    return rcpp_result_gen;
+END_RCPP
+}
+// metadata_cache_capacity
+int metadata_cache_capacity(double capacity);
+RcppExport SEXP _RParquet_metadata_cache_capacity(SEXP capacitySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< double >::type capacity(capacitySEXP);
+    rcpp_result_gen = Rcpp::wrap(metadata_cache_capacity(capacity));
     return rcpp_result_gen;
 END_RCPP
 }
 // write_rparquet
-int write_rparquet(DataFrame& df, std::string filename, CharacterVector col_types, IntegerVector selected_col, int group_rows, int verbose);
-RcppExport SEXP _RParquet_write_rparquet(SEXP dfSEXP, SEXP filenameSEXP, SEXP col_typesSEXP, SEXP selected_colSEXP, SEXP group_rowsSEXP, SEXP verboseSEXP) {
+SEXP write_rparquet(DataFrame& df, std::string filename, CharacterVector col_types, IntegerVector selected_col, int group_rows, int threads, List options, IntegerVector row_order, bool profile, int verbose);
+RcppExport SEXP _RParquet_write_rparquet(SEXP dfSEXP, SEXP filenameSEXP, SEXP col_typesSEXP, SEXP selected_colSEXP, SEXP group_rowsSEXP, SEXP threadsSEXP, SEXP optionsSEXP, SEXP row_orderSEXP, SEXP profileSEXP, SEXP verboseSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -44,20 +164,94 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< CharacterVector >::type col_types(col_typesSEXP);
     Rcpp::traits::input_parameter< IntegerVector >::type selected_col(selected_colSEXP);
     Rcpp::traits::input_parameter< int >::type group_rows(group_rowsSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< List >::type options(optionsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type row_order(row_orderSEXP);
+    Rcpp::traits::input_parameter< bool >::type profile(profileSEXP);
+    Rcpp::traits::input_parameter< int >::type verbose(verboseSEXP);
+    rcpp_result_gen = Rcpp::wrap(write_rparquet(df, filename, col_types, selected_col, group_rows, threads, options, row_order, profile, verbose));
+    return rcpp_result_gen;
+END_RCPP
+}
+// open_rparquet_writer
+SEXP open_rparquet_writer(std::string filename, IntegerVector selected_col, int group_rows, int threads, List options, bool profile, int verbose);
+RcppExport SEXP _RParquet_open_rparquet_writer(SEXP filenameSEXP, SEXP selected_colSEXP, SEXP group_rowsSEXP, SEXP threadsSEXP, SEXP optionsSEXP, SEXP profileSEXP, SEXP verboseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type filename(filenameSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type selected_col(selected_colSEXP);
+    Rcpp::traits::input_parameter< int >::type group_rows(group_rowsSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< List >::type options(optionsSEXP);
+    Rcpp::traits::input_parameter< bool >::type profile(profileSEXP);
     Rcpp::traits::input_parameter< int >::type verbose(verboseSEXP);
-    rcpp_result_gen = Rcpp::wrap(write_rparquet(df, filename, col_types, selected_col, group_rows, verbose));
+    rcpp_result_gen = Rcpp::wrap(open_rparquet_writer(filename, selected_col, group_rows, threads, options, profile, verbose));
+    return rcpp_result_gen;
+END_RCPP
+}
+// append_rparquet
+int append_rparquet(SEXP writer, DataFrame& df, CharacterVector col_types);
+RcppExport SEXP _RParquet_append_rparquet(SEXP writerSEXP, SEXP dfSEXP, SEXP col_typesSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type writer(writerSEXP);
+    Rcpp::traits::input_parameter< DataFrame& >::type df(dfSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type col_types(col_typesSEXP);
+    rcpp_result_gen = Rcpp::wrap(append_rparquet(writer, df, col_types));
+    return rcpp_result_gen;
+END_RCPP
+}
+// close_rparquet_writer
+SEXP close_rparquet_writer(SEXP writer);
+RcppExport SEXP _RParquet_close_rparquet_writer(SEXP writerSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type writer(writerSEXP);
+    rcpp_result_gen = Rcpp::wrap(close_rparquet_writer(writer));
+    return rcpp_result_gen;
+END_RCPP
+}
+// order_rparquet
+List order_rparquet(DataFrame& df, CharacterVector col_types, IntegerVector key_cols, int partition_keys, int threads);
+RcppExport SEXP _RParquet_order_rparquet(SEXP dfSEXP, SEXP col_typesSEXP, SEXP key_colsSEXP, SEXP partition_keysSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< DataFrame& >::type df(dfSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type col_types(col_typesSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type key_cols(key_colsSEXP);
+    Rcpp::traits::input_parameter< int >::type partition_keys(partition_keysSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(order_rparquet(df, col_types, key_cols, partition_keys, threads));
     return rcpp_result_gen;
 END_RCPP
 }
 
 static const R_CallMethodDef CallEntries[] = {
-    {"_RParquet_read_parquet", (DL_FUNC) &_RParquet_read_parquet, 6},
-    {"_RParquet_read_metadata", (DL_FUNC) &_RParquet_read_metadata, 2},
-    {"_RParquet_write_rparquet", (DL_FUNC) &_RParquet_write_rparquet, 6},
+    {"_RParquet_read_parquet", (DL_FUNC) &_RParquet_read_parquet, 13},
+    {"_RParquet_open_parquet", (DL_FUNC) &_RParquet_open_parquet, 12},
+    {"_RParquet_read_parquet_batch", (DL_FUNC) &_RParquet_read_parquet_batch, 2},
+    {"_RParquet_read_parquet_dataset", (DL_FUNC) &_RParquet_read_parquet_dataset, 7},
+    {"_RParquet_read_metadata", (DL_FUNC) &_RParquet_read_metadata, 3},
+    {"_RParquet_read_stats", (DL_FUNC) &_RParquet_read_stats, 2},
+    {"_RParquet_read_aggregate", (DL_FUNC) &_RParquet_read_aggregate, 8},
+    {"_RParquet_metadata_cache_info", (DL_FUNC) &_RParquet_metadata_cache_info, 0},
+    {"_RParquet_metadata_cache_clear", (DL_FUNC) &_RParquet_metadata_cache_clear, 0},
+    {"_RParquet_metadata_cache_capacity", (DL_FUNC) &_RParquet_metadata_cache_capacity, 1},
+    {"_RParquet_write_rparquet", (DL_FUNC) &_RParquet_write_rparquet, 10},
+    {"_RParquet_open_rparquet_writer", (DL_FUNC) &_RParquet_open_rparquet_writer, 7},
+    {"_RParquet_append_rparquet", (DL_FUNC) &_RParquet_append_rparquet, 3},
+    {"_RParquet_close_rparquet_writer", (DL_FUNC) &_RParquet_close_rparquet_writer, 1},
+    {"_RParquet_order_rparquet", (DL_FUNC) &_RParquet_order_rparquet, 5},
     {NULL, NULL, 0}
 };
 
+void rparquet_init_altrep(DllInfo* dll);
 RcppExport void R_init_RParquet(DllInfo *dll) {
     R_registerRoutines(dll, NULL, CallEntries, NULL, NULL);
     R_useDynamicSymbols(dll, FALSE);
+    rparquet_init_altrep(dll);
 }
@@ -1,12 +1,31 @@
 #include <arrow/api.h>
 #include <arrow/io/api.h>
 #include <parquet/arrow/reader.h>
+#include <parquet/arrow/schema.h>
 #include <parquet/arrow/writer.h>
 #include <parquet/api/reader.h>
 #include <parquet/exception.h>
+#include <arrow/util/bit-util.h>
 #include <Rcpp.h>
 #include <unordered_map>
-#include <arrow/util/thread-pool.h>
+#include <algorithm>
+#include <limits>
+#include <functional>
+#include <cmath>
+#include <stdexcept>
+#include "rparquet_tasks.h"
+#include "rparquet_metadata_cache.h"
+#include "rparquet_profile.h"
+#include "rparquet_unwind.h"
+#include <Rversion.h>
+#if R_VERSION >= R_Version(3, 6, 0)
+#define RPARQUET_ALTREP
+#include <R_ext/Altrep.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 using namespace Rcpp;
 namespace RParquet {
 
@@ -16,23 +35,391 @@ namespace Time_Constants {
   static const uint64_t ticks_per_micro  = 1000UL; // nanosecond resolution
 }
 
+// NA of bit64's integer64, which nanotime shares.
+static const int64_t NA_INTEGER64 = std::numeric_limits<int64_t>::min();
+
+// Number of nanoseconds in one tick of the given arrow time unit.
+static int64_t ticks_per_unit(arrow::TimeUnit::type unit) {
+  switch (unit) {
+    case arrow::TimeUnit::SECOND:
+      return Time_Constants::ticks_per_second;
+    case arrow::TimeUnit::MILLI:
+      return Time_Constants::ticks_per_mili;
+    case arrow::TimeUnit::MICRO:
+      return Time_Constants::ticks_per_micro;
+    default:
+      return 1;
+  }
+}
+
+// Writes NA into out[i] for every null slot of the array. The validity bitmap
+// is scanned 64 slots per word, so arrays with few nulls cost one load per 64
+// rows.
+template <typename ValueType>
+static void patch_nulls(const arrow::Array& array, ValueType NA, ValueType* out) {
+  const uint8_t* bitmap = array.null_bitmap_data();
+  if (array.null_count() == 0 || bitmap == nullptr) {
+    return;
+  }
+  int64_t length = array.length();
+  int64_t i = 0;
+  if (array.offset() % 8 == 0) {
+    const uint8_t* bytes = bitmap + array.offset() / 8;
+    for (; i + 64 <= length; i += 64) {
+      uint64_t word;
+      std::memcpy(&word, bytes + i / 8, sizeof(word));
+      for (uint64_t nulls = ~word; nulls != 0; nulls &= nulls - 1) {
+        out[i + __builtin_ctzll(nulls)] = NA;
+      }
+    }
+  }
+  for (; i < length; ++i) {
+    if (!arrow::BitUtil::GetBit(bitmap, array.offset() + i)) {
+      out[i] = NA;
+    }
+  }
+}
+
+// Length of the R string made from the bytes: R strings stop at the first
+// nul, as they did when going through std::string.
+static int32_t r_string_len(const char* data, int32_t len) {
+  const void* nul = std::memchr(data, 0, len);
+  return nul == nullptr ? len : static_cast<const char*>(nul) - data;
+}
+
+static uint64_t hash_bytes(const char* data, int32_t len) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (int32_t i = 0; i < len; ++i) {
+    hash = (hash ^ static_cast<uint8_t>(data[i])) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Open addressing table from string bytes to the CHARSXP made for them, so a
+// value repeated across rows is turned into a CHARSXP once. The CHARSXPs are
+// kept alive by the character vector being filled, the table only borrows
+// them. Once max_size values are cached new values are no longer added.
+// Main thread only.
+class CharSXP_Cache {
+public:
+  CharSXP_Cache(size_t max_size, cetype_t encoding) :
+    m_max_size(max_size),
+    m_size(0),
+    m_encoding(encoding),
+    m_slots(max_size == 0 ? 0 : 1024) {
+  }
+
+  SEXP get(const char* data, int32_t len) {
+    len = r_string_len(data, len);
+    if (m_slots.empty()) {
+      return Rf_mkCharLenCE(data, len, m_encoding);
+    }
+    uint64_t hash = hash_bytes(data, len);
+    size_t mask = m_slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      Slot& slot = m_slots[i];
+      if (slot.value == nullptr) {
+        SEXP value = Rf_mkCharLenCE(data, len, m_encoding);
+        if (m_size < m_max_size) {
+          slot.hash = hash;
+          slot.value = value;
+          if (++m_size * 2 > m_slots.size()) {
+            grow();
+          }
+        }
+        return value;
+      }
+      if (slot.hash == hash && LENGTH(slot.value) == len && std::memcmp(CHAR(slot.value), data, len) == 0) {
+        return slot.value;
+      }
+    }
+  }
+
+private:
+  struct Slot {
+    uint64_t hash = 0;
+    SEXP     value = nullptr;
+  };
+
+  void grow() {
+    std::vector<Slot> slots(m_slots.size() * 2);
+    size_t mask = slots.size() - 1;
+    for (auto &slot : m_slots) {
+      if (slot.value != nullptr) {
+        size_t i = slot.hash & mask;
+        while (slots[i].value != nullptr) {
+          i = (i + 1) & mask;
+        }
+        slots[i] = slot;
+      }
+    }
+    m_slots.swap(slots);
+  }
+
+  size_t            m_max_size;
+  size_t            m_size;
+  cetype_t          m_encoding;
+  std::vector<Slot> m_slots;
+};
+
+// Maps string bytes to 1-based factor codes, keeping each distinct value once
+// as a level. No R API calls.
+class Factor_Levels {
+public:
+  Factor_Levels() : m_slots(1024, 0) {
+  }
+
+  int code(const char* data, int32_t len) {
+    len = r_string_len(data, len);
+    uint64_t hash = hash_bytes(data, len);
+    size_t mask = m_slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      int code = m_slots[i];
+      if (code == 0) {
+        m_levels.emplace_back(data, len);
+        m_hashes.push_back(hash);
+        m_slots[i] = m_levels.size();
+        if (m_levels.size() * 2 > m_slots.size()) {
+          grow();
+        }
+        return m_levels.size();
+      }
+      const std::string& level = m_levels[code - 1];
+      if (m_hashes[code - 1] == hash && static_cast<int32_t>(level.size()) == len &&
+          std::memcmp(level.data(), data, len) == 0) {
+        return code;
+      }
+    }
+  }
+
+  const std::vector<std::string>& levels() const {
+    return m_levels;
+  }
+
+private:
+  void grow() {
+    std::vector<int> slots(m_slots.size() * 2, 0);
+    size_t mask = slots.size() - 1;
+    for (size_t code = 1; code <= m_levels.size(); ++code) {
+      size_t i = m_hashes[code - 1] & mask;
+      while (slots[i] != 0) {
+        i = (i + 1) & mask;
+      }
+      slots[i] = code;
+    }
+    m_slots.swap(slots);
+  }
+
+  std::vector<int>         m_slots;
+  std::vector<uint64_t>    m_hashes;
+  std::vector<std::string> m_levels;
+};
+
+// A "where" condition on one column. Values are kept in the domain of the
+// column type: int64 for INT32/INT64/TIMESTAMP (in the unit of the column)/
+// BOOL, double for DOUBLE and std::string for STRING. A range holds {lo, hi}
+// (inclusive), a set holds its sorted, unique members.
+struct Column_Predicate {
+  int                      col_idx;
+  bool                     is_range;
+  std::vector<int64_t>     int_values;
+  std::vector<double>      dbl_values;
+  std::vector<std::string> str_values;
+};
+
+// Rows of one row group to read. Unless all rows are selected, rows holds
+// the sorted indices (relative to the row group) of the selected rows, so a
+// selection costs memory per selected row, not per file row.
+struct Row_Selection {
+  bool                 all;
+  std::vector<int32_t> rows;
+
+  int64_t size(int64_t group_rows) const {
+    return all ? group_rows : rows.size();
+  }
+  void normalize(int64_t group_rows) {
+    if (!all && static_cast<int64_t>(rows.size()) == group_rows) {
+      all = true;
+      rows.clear();
+    }
+  }
+  void intersect(Row_Selection&& other) {
+    if (other.all) {
+      return;
+    }
+    if (all) {
+      *this = std::move(other);
+      return;
+    }
+    std::vector<int32_t> both;
+    std::set_intersection(rows.begin(), rows.end(), other.rows.begin(), other.rows.end(),
+                          std::back_inserter(both));
+    rows.swap(both);
+  }
+};
+
+template <typename T>
+static bool is_nan_value(const T&) {
+  return false;
+}
+
+static bool is_nan_value(double value) {
+  return std::isnan(value);
+}
+
+// NaN, which compares false to everything, matches no condition.
+template <typename T>
+static bool value_match(const T& value, const std::vector<T>& values, bool is_range) {
+  if (is_nan_value(value)) {
+    return false;
+  }
+  if (is_range) {
+    return !(value < values[0]) && !(values[1] < value);
+  }
+  return std::binary_search(values.begin(), values.end(), value);
+}
+
+// True if any value accepted by the predicate can lie inside [min, max].
+template <typename T>
+static bool value_overlap(const T& min, const T& max, const std::vector<T>& values, bool is_range) {
+  if (is_range) {
+    return !(max < values[0]) && !(values[1] < min);
+  }
+  auto it = std::lower_bound(values.begin(), values.end(), min);
+  return it != values.end() && !(max < *it);
+}
+
+template <typename T>
+static void sort_values(std::vector<T>& values, bool is_range) {
+  if (!is_range) {
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+  }
+}
+
+// Converts a double to int64 for a where condition on an integer column. A
+// range keeps the integers within its bounds: lo is rounded up, hi down, and
+// both are clamped to the int64 range. A set member which is not a whole int64
+// can not match, false is returned.
+static bool double_to_int64(double value, bool is_range, bool is_lo, int64_t* result) {
+  const double two_63 = 9223372036854775808.0;
+  if (is_range) {
+    value = is_lo ? std::ceil(value) : std::floor(value);
+  } else if (value != std::floor(value)) {
+    return false;
+  }
+  if (value >= two_63 || value < -two_63) {
+    if (!is_range) {
+      return false;
+    }
+    *result = value > 0 ? std::numeric_limits<int64_t>::max() : std::numeric_limits<int64_t>::min();
+    return true;
+  }
+  *result = static_cast<int64_t>(value);
+  return true;
+}
+
+// Turns the nanoseconds of a where condition on a timestamp column into its
+// unit, scale nanoseconds each, so the values of the column are compared
+// without scaling them. A range keeps the whole units within it, a set the
+// members which are whole units.
+static void to_col_unit(std::vector<int64_t>& values, int64_t scale, bool is_range) {
+  if (scale == 1) {
+    return;
+  }
+  auto floor_div = [scale](int64_t v) { return v / scale - (v % scale < 0); };
+  if (is_range) {
+    values[0] = -floor_div(-std::max(values[0], -std::numeric_limits<int64_t>::max()));
+    values[1] = floor_div(values[1]);
+    return;
+  }
+  values.erase(std::remove_if(values.begin(), values.end(), [scale](int64_t v) { return v % scale != 0; }),
+               values.end());
+  for (auto &v : values) {
+    v /= scale;
+  }
+}
+
+static std::vector<int64_t> as_int64_values(SEXP values, const std::string& name, bool is_range) {
+  R_xlen_t n = Rf_xlength(values);
+  std::vector<int64_t> result(n);
+  if (Rf_inherits(values, "integer64") || Rf_inherits(values, "nanotime")) {
+    std::memcpy(result.data(), REAL(values), n * sizeof(int64_t));
+    if (std::find(result.begin(), result.end(), std::numeric_limits<int64_t>::min()) != result.end()) {
+      stop("NA is not allowed in where condition of column %s", name);
+    }
+    return result;
+  }
+  switch (TYPEOF(values)) {
+    case INTSXP:
+    case LGLSXP:
+      for (R_xlen_t i = 0; i < n; ++i) {
+        if (INTEGER(values)[i] == NA_INTEGER) {
+          stop("NA is not allowed in where condition of column %s", name);
+        }
+        result[i] = INTEGER(values)[i];
+      }
+      break;
+    case REALSXP: {
+      result.clear();
+      for (R_xlen_t i = 0; i < n; ++i) {
+        if (ISNAN(REAL(values)[i])) {
+          stop("NA is not allowed in where condition of column %s", name);
+        }
+        int64_t value;
+        if (double_to_int64(REAL(values)[i], is_range, i == 0, &value)) {
+          result.push_back(value);
+        }
+      }
+      break;
+    }
+    default:
+      stop("Unsupported where condition type for column %s", name);
+  }
+  return result;
+}
+
+// Decoded chunk of a row group of a column, or a converter of one into an R
+// vector. Sources hand out the chunks of one column in row group order.
+typedef Task_Pipeline<std::shared_ptr<arrow::Array>>          Chunk_Pipeline;
+typedef std::function<std::shared_ptr<arrow::Array>(int)>     Chunk_Source;
+typedef std::function<void(const arrow::Array&)>              Chunk_Converter;
+
 class RParquet_Reader
 {
 public:
   RParquet_Reader(std::string filename,
                   IntegerVector selected_col,
                   LogicalVector filter,
+                  List where,
+                  NumericVector row_from,
+                  NumericVector row_to,
+                  bool as_factor,
                   int read_row_size,
                   int threads,
+                  List io_options,
+                  bool profile,
                   int verbose
                   ) :
     m_filename(filename),
     m_col_idx(as<std::vector<int>>(selected_col)),
-    m_row_filter(as<std::vector<int>>(filter)),
+    m_filter(filter),
+    m_where(where),
+    m_row_from(row_from),
+    m_row_to(row_to),
+    m_as_factor(as_factor),
     m_read_row_size(read_row_size),
     m_threads(threads),
-    m_verbose(verbose)
+    m_verbose(verbose),
+    m_profile(profile ? new Profile() : nullptr)
     {
+      m_mmap = io_options.containsElementNamed("mmap") && as<bool>(io_options["mmap"]);
+      m_buffer_size = io_options.containsElementNamed("buffer_size") ? as<double>(io_options["buffer_size"]) : 0;
+      m_prefetch = io_options.containsElementNamed("prefetch") && as<bool>(io_options["prefetch"]);
+      m_pipeline_depth = io_options.containsElementNamed("pipeline_depth") ?
+        as<int>(io_options["pipeline_depth"]) : m_default_pipeline_depth;
+      m_pipeline_memory = io_options.containsElementNamed("pipeline_memory") ?
+        as<double>(io_options["pipeline_memory"]) : m_default_pipeline_memory;
     }
 
   ~RParquet_Reader(){}
@@ -41,30 +428,48 @@ public:
     if (m_read_row_size < 1) {
       stop("Read row size should greater than 0.");
     }
-    m_row_selected_size = std::count(m_row_filter.begin(), m_row_filter.end(), 1);
-    if (m_row_selected_size == 0) {
+    // NA in the filter means the row is not selected.
+    if (std::find(m_filter.begin(), m_filter.end(), TRUE) == m_filter.end()) {
       stop("All rows are skipped by the filter.");
     }
-    std::shared_ptr<arrow::io::ReadableFile> infile;
-    PARQUET_THROW_NOT_OK(arrow::io::ReadableFile::Open(m_filename, arrow::default_memory_pool(), &infile));
-    PARQUET_THROW_NOT_OK(parquet::arrow::OpenFile(infile, arrow::default_memory_pool(), &m_reader));
-    if(m_threads > 1) {
-     PARQUET_THROW_NOT_OK(arrow::SetCpuThreadPoolCapacity(m_threads));
-     m_reader->set_use_threads(true);
+    if (m_row_from.size() != m_row_to.size()) {
+      stop("Row range starts and ends should have the same length.");
+    }
+    m_has_filter = m_filter.size() != 1 || m_row_from.size() != 0;
+    if (m_buffer_size < 0) {
+      stop("Buffer size should not be negative.");
+    }
+    if (m_pipeline_depth < 0 || m_pipeline_memory < 0) {
+      stop("Pipeline depth and memory should not be negative.");
+    }
+    // The footer and the schema come from the metadata cache when the file
+    // has not changed since they were read, column chunks are decoded on
+    // demand in create_df().
+    Profile::Time_Point start = Profile::now();
+    m_cached_metadata = cached_metadata(m_filename);
+    m_file_metadata = m_cached_metadata->metadata();
+    profile_phase("footer", -1, -1, start, m_file_metadata->size());
+    start = Profile::now();
+    open_file();
+    profile_phase("open", -1, -1, start);
+    m_schema = m_cached_metadata->schema();
+    if (m_schema == nullptr) {
+      PARQUET_THROW_NOT_OK(m_reader->GetSchema(&m_schema));
+      m_cached_metadata->set_schema(m_schema);
     }
-    PARQUET_THROW_NOT_OK(m_reader->ReadTable(&m_table));
-
-    m_rows = m_table->num_rows();
-    m_cols = m_table->num_columns();
-    m_schema = m_table->schema();
-    m_row_groups = m_reader->num_row_groups();
-    m_rows_per_group = m_read_row_size > m_rows ? (m_rows / m_row_groups) : m_read_row_size;
 
-    if (m_row_selected_size == 1 && m_row_filter.size() == 1) {
-      m_row_selected_size = 0;
-    } else if (m_row_selected_size != 0 && m_row_filter.size() < m_rows) {
-      m_row_filter.resize(m_rows, 0);
+    m_rows = m_file_metadata->num_rows();
+    m_cols = m_schema->num_fields();
+    m_row_groups = m_file_metadata->num_row_groups();
+    // First file row of each row group.
+    int64_t row_offset = 0;
+    for (auto group_idx = 0; group_idx < m_row_groups; ++group_idx) {
+      m_group_rows.push_back(m_file_metadata->RowGroup(group_idx)->num_rows());
+      m_group_row_offset.push_back(row_offset);
+      row_offset += m_group_rows.back();
     }
+    m_rows_per_group = m_read_row_size > m_rows ? (m_rows / std::max(m_row_groups, 1)) : m_read_row_size;
+
     if (m_col_idx.size() == 1 && m_col_idx[0] == -1) {
       int i = 1;
       while(i <= m_cols) {
@@ -85,6 +490,21 @@ public:
       m_col_types_names.push_back(f->type()->name());
     }
 
+    start = Profile::now();
+    init_selection();
+    init_predicates();
+    apply_predicates();
+    // Selected rows and first output row of each row group.
+    int64_t out_offset = 0;
+    for (auto group_idx = 0; group_idx < m_row_groups; ++group_idx) {
+      m_group_selected.push_back(m_selection[group_idx].size(m_group_rows[group_idx]));
+      m_group_out_offset.push_back(out_offset);
+      out_offset += m_group_selected.back();
+    }
+    m_row_selected_size = out_offset;
+    profile_phase("plan", -1, -1, start, -1, m_row_selected_size);
+    m_next_group = 0;
+
     if (m_verbose == 1) {
       Rcout << "\n";
       Rcout << "TOTAL ROWS:" << m_rows<<"\n";
@@ -96,242 +516,2770 @@ public:
       Rcout << "ROW GROUPS:" << m_row_groups<<"\n";
       Rcout << "ROWS/GROUP:" << m_rows / m_row_groups <<"\n";
       Rcout << "EACH READ SIZE:" << m_rows_per_group <<"\n";
-      Rcout << "ROW FILTER SIZE:" << m_row_selected_size <<"\n";
+      Rcout << "ROW FILTER SIZE:" << (m_has_filter ? m_row_selected_size : 0) <<"\n";
+      Rcout << "ROW GROUPS SKIPPED:" << m_groups_skipped <<"\n";
+      Rcout << "INPUT:" << (m_mmap ? "mmap" : "file") << (m_buffer_size > 0 ? ", buffered" : "")
+            << (m_prefetch ? ", prefetch" : "") <<"\n";
+      Rcout << "PIPELINE DEPTH:" << m_pipeline_depth << ", MEMORY:" << m_pipeline_memory <<"\n";
       Rcout << "SCHEMA:\n" << m_schema->ToString()<<"\n";
     }
   }
 
-  SEXP create_df(){
+  // Opens the file with the cached footer for decoding.
+  void open_file() {
+    // A memory mapped file hands out slices of the mapping, so pages come
+    // from the OS page cache and are shared between sessions reading it.
+    std::shared_ptr<arrow::io::RandomAccessFile> infile;
+    if (m_mmap) {
+      std::shared_ptr<arrow::io::MemoryMappedFile> mapped_file;
+      PARQUET_THROW_NOT_OK(arrow::io::MemoryMappedFile::Open(m_filename, arrow::io::FileMode::READ, &mapped_file));
+      infile = mapped_file;
+    } else {
+      std::shared_ptr<arrow::io::ReadableFile> readable_file;
+      PARQUET_THROW_NOT_OK(arrow::io::ReadableFile::Open(m_filename, memory_pool(), &readable_file));
+      infile = readable_file;
+    }
+    // Buffered streams read a column chunk buffer_size bytes at a time instead
+    // of all at once.
+    parquet::ReaderProperties properties(memory_pool());
+    if (m_buffer_size > 0) {
+      properties.enable_buffered_stream();
+      properties.set_buffer_size(static_cast<int64_t>(m_buffer_size));
+    }
+    PARQUET_THROW_NOT_OK(parquet::arrow::OpenFile(infile, memory_pool(), properties, m_file_metadata, &m_reader));
+  }
+
+  // Releases the file descriptor, open_file() opens it again before decoding.
+  void close_file() {
+    m_reader.reset();
+  }
+
+  SEXP create_df() {
+    return create_df(0, m_row_groups);
+  }
+
+  // Returns the next batch of whole row groups holding at least batch_rows
+  // selected rows (or the rest of the file), or R_NilValue at the end. Only
+  // the row groups of the batch are decoded.
+  SEXP next_batch(int batch_rows) {
+    if (batch_rows < 1) {
+      stop("Batch size should greater than 0.");
+    }
+    while (m_next_group < m_row_groups && skip_group(m_next_group)) {
+      m_next_group++;
+    }
+    if (m_next_group == m_row_groups) {
+      return R_NilValue;
+    }
+    int first_group = m_next_group;
+    int64_t rows = 0;
+    while (m_next_group < m_row_groups && rows < batch_rows) {
+      rows += m_group_selected[m_next_group++];
+    }
+    return create_df(first_group, m_next_group);
+  }
+
+  // The R vectors for the row groups [first_group, last_group) are allocated
+  // here, then each (column, row group) pair is decoded and converted straight
+  // into its slice of the vector by the workers. Strings are decoded by the
+  // workers but their CHARSXPs are made on this thread, one column at a time.
+  // With as_factor, dictionary encoded string columns become factors.
+  SEXP create_df(int first_group, int last_group) {
+    int64_t base = first_group < m_row_groups ? m_group_out_offset[first_group] : m_row_selected_size;
+    int capacity = (last_group < m_row_groups ? m_group_out_offset[last_group] : m_row_selected_size) - base;
     int selected_col_size = m_col_idx_set.size();
     List col_list(selected_col_size);
     List col_name(selected_col_size);
-      int index = 0;
-      for (auto &col_idx: m_col_idx_set) {
-        col_name[index] = m_col_names[col_idx - 1];
-        col_list[index] = read_col(col_idx - 1);
-        index++;
-      }
-      col_list.attr("names") = col_name;
-      col_list.attr("row.names") = IntegerVector::create(NA_INTEGER, -m_rows);
-    return col_list;
-  }
-
-  SEXP read_col(int col_idx) {
-    int capacity{m_row_selected_size == 0 ? m_rows : m_row_selected_size};
-    switch(m_col_types[col_idx]) {
-      case arrow::Type::type::INT64: {
-        NumericVector nvec = NumericVector(capacity);
-        const int64_t* data;
-        read_row_group<arrow::Int64Array>(NA_REAL, data, nvec, col_idx,
-            [](auto arrow_ary, auto i, int64_t idx, const auto* raw_data_ary, auto &rcpp_vec)
-            {std::memcpy(&(rcpp_vec[idx]), &(raw_data_ary[i]), sizeof(double));});
-        nvec.attr("class") = "integer64";
-        return nvec;
-       }
-      case arrow::Type::type::DOUBLE: {
-        NumericVector nvec = NumericVector(capacity);
-        const double* data;
-        read_row_group<arrow::DoubleArray>(NA_REAL, data, nvec, col_idx,
-            [](auto arrow_ary, auto i, int64_t idx, const auto* raw_data_ary, auto &rcpp_vec)
-            { rcpp_vec[idx] = raw_data_ary[i];});
-        return nvec;
+    std::vector<std::function<void()>> tasks;
+    std::vector<std::pair<int, int>> string_cols;
+    Profile::Time_Point df_start = Profile::now();
+    if (m_prefetch) {
+      prefetch_chunks(first_group, last_group);
+      profile_phase("prefetch", -1, -1, df_start);
+    }
+    std::vector<std::pair<int, int>> fixed_cols;
+    int index = 0;
+    for (auto &col_idx: m_col_idx_set) {
+      col_name[index] = m_col_names[col_idx - 1];
+      // Every R vector is allocated here, before the pipeline starts.
+      Profile::Time_Point start = Profile::now();
+      if (is_factor_col(col_idx - 1)) {
+        col_list[index] = IntegerVector(capacity);
+      } else {
+        col_list[index] = alloc_col(col_idx - 1, capacity);
       }
-      case arrow::Type::type::INT32: {
-        IntegerVector ivec = IntegerVector(capacity);
-        const int32_t* data;
-        read_row_group<arrow::Int32Array>(NA_INTEGER, data, ivec, col_idx,
-            [](auto arrow_ary, auto i, int64_t idx, const auto* raw_data_ary, auto &rcpp_vec)
-            { rcpp_vec[idx] = raw_data_ary[i];});
-        return ivec;
+      profile_phase("alloc", col_idx - 1, -1, start, r_vector_bytes(col_list[index]));
+      if (is_string_col(col_idx - 1)) {
+        string_cols.emplace_back(index, col_idx - 1);
+      } else {
+        fixed_cols.emplace_back(index, col_idx - 1);
       }
-      case arrow::Type::type::BOOL: {
-        LogicalVector lvec = LogicalVector(capacity);
-        const uint8_t* data;
-        int64_t offset = 0;
-        int64_t filter_offset = 0;
-        for (auto group_idx = 0; group_idx < m_row_groups; ++group_idx) {
-          std::shared_ptr<arrow::Array> array;
-          PARQUET_THROW_NOT_OK(m_reader->RowGroup(group_idx)->Column(col_idx)->Read(&array));
-          std::shared_ptr<arrow::BooleanArray> arrow_array = std::static_pointer_cast<arrow::BooleanArray>(array);
-          auto row_len = arrow_array->length();
-          if (m_row_selected_size == 0) {
-            for (auto i = 0; i < row_len; ++i) {
-              if (array->IsNull(i)) {
-                lvec[i+ offset] = NA_LOGICAL;
-              } else {
-                lvec[i + offset] = arrow_array->Value(i);
-              }
-             }
-           } else {
-           for (auto i = 0; i < row_len; ++i) {
-              if (m_row_filter[i + offset]) {
-                if (arrow_array->IsNull(i)) {
-                  lvec[filter_offset++] = NA_LOGICAL;
-                } else {
-                  lvec[filter_offset++] = arrow_array->Value(i);
-                }
-              }
-            }
+      index++;
+    }
+    // The chunks converted on the main thread are decoded ahead by the
+    // pipeline: those of the string columns, and with a single thread those
+    // of the fixed width columns, which the workers otherwise decode and
+    // convert in parallel. The pipeline then starts once the workers are
+    // done, so no more than threads chunks are decoded at once. While it runs
+    // the only R calls are the protected ones of fill_string_col, and the
+    // factor levels are made once it is joined.
+    bool convert_fixed = m_pipeline_depth > 0 && m_threads <= 1;
+    std::vector<int> pipeline_cols;
+    for (auto &fixed_col : fixed_cols) {
+      if (convert_fixed) {
+        pipeline_cols.push_back(fixed_col.second);
+      }
+    }
+    for (auto &string_col : string_cols) {
+      pipeline_cols.push_back(string_col.second);
+    }
+    std::unique_ptr<Chunk_Pipeline> pipeline;
+    if (convert_fixed) {
+      pipeline = chunk_pipeline(pipeline_cols, first_group, last_group);
+    }
+    for (auto &fixed_col : fixed_cols) {
+      if (convert_fixed) {
+        for (auto group_idx = first_group; group_idx < last_group; ++group_idx) {
+          if (!skip_group(group_idx)) {
+            int64_t group_offset = m_group_out_offset[group_idx] - m_group_out_offset[first_group];
+            col_converter(fixed_col.second, group_idx, col_list[fixed_col.first], group_offset)(*pipeline->take());
           }
-          offset += row_len;
         }
-        return lvec;
+      } else {
+        add_col_tasks(fixed_col.second, first_group, last_group, col_list[fixed_col.first], 0, tasks);
       }
-      case arrow::Type::type::BINARY:
-      case arrow::Type::type::STRING: {
-        CharacterVector cvec = CharacterVector(capacity);
-        const std::string* data;
-        int64_t offset = 0;
-        int64_t filter_offset = 0;
-        for (auto group_idx = 0; group_idx < m_row_groups; ++group_idx) {
-          std::shared_ptr<arrow::Array> array;
-          PARQUET_THROW_NOT_OK(m_reader->RowGroup(group_idx)->Column(col_idx)->Read(&array));
-          std::shared_ptr<arrow::StringArray> arrow_array = std::static_pointer_cast<arrow::StringArray>(array);
-          auto row_len = arrow_array->length();
-          if (m_row_selected_size == 0) {
-            for (auto i = 0; i < row_len; ++i) {
-              if (array->IsNull(i)) {
-                cvec[i+ offset] = NA_STRING;
-              } else {
-                cvec[i + offset] = arrow_array->GetString(i);
-              }
-             }
-          } else {
-            for (auto i = 0; i < row_len; ++i) {
-              if (m_row_filter[i + offset]) {
-                if (arrow_array->IsNull(i)) {
-                  cvec[filter_offset++] = NA_STRING;
-                } else {
-                  cvec[filter_offset++] = arrow_array->GetString(i);
-                }
-              }
-            }
+    }
+    run_tasks(tasks, m_threads);
+    if (m_pipeline_depth > 0 && !convert_fixed) {
+      pipeline = chunk_pipeline(pipeline_cols, first_group, last_group);
+    }
+    Chunk_Source source = nullptr;
+    if (pipeline) {
+      source = [&pipeline](int) { return pipeline->take(); };
+    }
+    std::vector<Factor_Levels> levels(string_cols.size());
+    for (size_t k = 0; k < string_cols.size(); ++k) {
+      int col_idx = string_cols[k].second;
+      SEXP vec = col_list[string_cols[k].first];
+      if (is_factor_col(col_idx)) {
+        read_factor_codes(col_idx, INTEGER(vec), levels[k], first_group, last_group, source);
+      } else {
+        read_string_col(col_idx, vec, first_group, last_group, source);
+      }
+    }
+    pipeline.reset();
+    for (size_t k = 0; k < string_cols.size(); ++k) {
+      if (is_factor_col(string_cols[k].second)) {
+        IntegerVector ivec = col_list[string_cols[k].first];
+        set_factor_levels(ivec, levels[k],
+                          m_col_types[string_cols[k].second] == arrow::Type::type::STRING ? CE_UTF8 : CE_NATIVE);
+      }
+    }
+    col_list.attr("names") = col_name;
+    col_list.attr("row.names") = IntegerVector::create(NA_INTEGER, -capacity);
+    col_list.attr("class") = "data.frame";
+    if (m_profile) {
+      profile_phase("total", -1, -1, df_start, -1, capacity);
+      col_list.attr("rparquet_profile") = m_profile->take(m_col_names);
+    }
+    return col_list;
+  }
+
+  // Turns the logical filter and the 1-based inclusive row ranges into per
+  // row group selections. Ranges may overlap and are clipped to the file.
+  void init_selection() {
+    m_selection.assign(m_row_groups, Row_Selection{true, {}});
+    if (m_filter.size() != 1) {
+      const int* filter = LOGICAL(m_filter);
+      int64_t filter_size = m_filter.size();
+      for (auto group_idx = 0; group_idx < m_row_groups; ++group_idx) {
+        Row_Selection selection{false, {}};
+        int64_t begin = m_group_row_offset[group_idx];
+        int64_t end = std::min(begin + m_group_rows[group_idx], filter_size);
+        for (int64_t row = begin; row < end; ++row) {
+          if (filter[row] == TRUE) {
+            selection.rows.push_back(row - begin);
           }
-          offset += row_len;
         }
-        return cvec;
+        selection.normalize(m_group_rows[group_idx]);
+        m_selection[group_idx] = std::move(selection);
       }
-      case arrow::Type::type::TIMESTAMP: {
-        NumericVector nvec = NumericVector(capacity);
-        const int64_t* data;
-        read_row_group<arrow::TimestampArray>(NA_REAL, data, nvec, col_idx,
-            [](auto arrow_ary, auto i, int64_t idx, const auto* raw_data_ary, auto &rcpp_vec){
-        int64_t nano_t = raw_data_ary[i];
-        switch (std::dynamic_pointer_cast<arrow::TimestampType>(arrow_ary->type())->unit()) { // ->timezone()
-          case arrow::TimeUnit::SECOND:
-            nano_t = raw_data_ary[i]*Time_Constants::ticks_per_second;
-            break;
-          case arrow::TimeUnit::MILLI:
-            nano_t = raw_data_ary[i]*Time_Constants::ticks_per_mili;
-            break;
-          case arrow::TimeUnit::MICRO:
-            nano_t = raw_data_ary[i]*Time_Constants::ticks_per_micro;
-            break;
-        }
-        std::memcpy(&(rcpp_vec[idx]), &(nano_t), sizeof(double));});
-        Rcpp::CharacterVector cl = Rcpp::CharacterVector::create("nanotime");
-        cl.attr("package") = "nanotime";
-        nvec.attr(".S3Class") = "integer64";
-        nvec.attr("class") = cl;
-        SET_S4_OBJECT(nvec);
-        return Rcpp::S4(nvec);
+    }
+    if (m_row_from.size() == 0) {
+      return;
+    }
+    std::vector<Row_Selection> ranges(m_row_groups, Row_Selection{false, {}});
+    for (R_xlen_t k = 0; k < m_row_from.size(); ++k) {
+      double from = m_row_from[k];
+      double to = m_row_to[k];
+      if (ISNAN(from) || ISNAN(to) || from < 1 || to < from) {
+        stop("Invalid row range [%f, %f]", from, to);
       }
-      default: {
-         stop("Unknown column, name:%s, type: %s",
-             m_col_names[col_idx], m_col_types_names[col_idx]);
+      int64_t first = static_cast<int64_t>(from) - 1;
+      int64_t last = std::min<int64_t>(static_cast<int64_t>(to), m_rows) - 1;
+      if (first > last) {
+        continue;
+      }
+      auto group_idx = std::upper_bound(m_group_row_offset.begin(), m_group_row_offset.end(), first)
+        - m_group_row_offset.begin() - 1;
+      for (; group_idx < m_row_groups && m_group_row_offset[group_idx] <= last; ++group_idx) {
+        int64_t begin = m_group_row_offset[group_idx];
+        int64_t lo = std::max(first, begin) - begin;
+        int64_t hi = std::min(last - begin, m_group_rows[group_idx] - 1);
+        auto &selection = ranges[group_idx];
+        if (lo == 0 && hi == m_group_rows[group_idx] - 1) {
+          selection.all = true;
+        } else if (!selection.all) {
+          for (int64_t row = lo; row <= hi; ++row) {
+            selection.rows.push_back(row);
+          }
+        }
       }
     }
+    for (auto group_idx = 0; group_idx < m_row_groups; ++group_idx) {
+      auto &selection = ranges[group_idx];
+      if (selection.all) {
+        selection.rows.clear();
+      } else {
+        std::sort(selection.rows.begin(), selection.rows.end());
+        selection.rows.erase(std::unique(selection.rows.begin(), selection.rows.end()), selection.rows.end());
+        selection.normalize(m_group_rows[group_idx]);
+      }
+      m_selection[group_idx].intersect(std::move(selection));
+    }
   }
 
-  template <typename ArrowArrayType, typename NAType, typename DataType, typename VectorType, typename FuncType>
-  void read_row_group(NAType NA, const DataType* data, VectorType& rcpp_vec, int col_idx, FuncType convert_to_rvector) {
-    int64_t offset = 0;
-    int64_t filter_offset = 0;
-    for (auto group_idx = 0; group_idx < m_row_groups; ++group_idx) {
-      std::shared_ptr<arrow::Array> array;
-      PARQUET_THROW_NOT_OK(m_reader->RowGroup(group_idx)->Column(col_idx)->Read(&array));
-      std::shared_ptr<ArrowArrayType> arrow_array = std::static_pointer_cast<ArrowArrayType>(array);
-      auto row_len = arrow_array->length();
-      data = arrow_array->raw_values();
-      if (m_row_selected_size == 0) {
-        for (auto i = 0; i < row_len; ++i) {
-            if (arrow_array->IsNull(i)) {
-              rcpp_vec[i+ offset] = NA;
-            } else {
-              int64_t idx =  i + offset;
-              convert_to_rvector(arrow_array, i, idx, data, rcpp_vec);
-            }
+  // Parses the named "where" list into per column predicates. A length two
+  // vector is an inclusive range c(lo, hi), anything else (or a vector wrapped
+  // in I()) is a set of accepted values.
+  void init_predicates() {
+    if (m_where.size() == 0) {
+      return;
+    }
+    if (Rf_isNull(Rf_getAttrib(m_where, R_NamesSymbol))) {
+      stop("The where conditions should be a named list.");
+    }
+    CharacterVector names = m_where.names();
+    for (int i = 0; i < m_where.size(); ++i) {
+      std::string name = as<std::string>(names[i]);
+      auto it = std::find(m_col_names.begin(), m_col_names.end(), name);
+      if (it == m_col_names.end()) {
+        stop("Unknown column in where condition: %s", name);
+      }
+      SEXP values = m_where[i];
+      if (Rf_xlength(values) == 0) {
+        stop("Empty where condition of column %s", name);
+      }
+      Column_Predicate pred;
+      pred.col_idx = it - m_col_names.begin();
+      pred.is_range = Rf_xlength(values) == 2 && !Rf_inherits(values, "AsIs");
+      switch (m_col_types[pred.col_idx]) {
+        case arrow::Type::type::TIMESTAMP:
+        case arrow::Type::type::INT32:
+        case arrow::Type::type::INT64:
+        case arrow::Type::type::BOOL:
+          pred.int_values = as_int64_values(values, name, pred.is_range);
+          to_col_unit(pred.int_values, col_scale(pred.col_idx), pred.is_range);
+          sort_values(pred.int_values, pred.is_range);
+          break;
+        case arrow::Type::type::DOUBLE:
+          pred.dbl_values = as<std::vector<double>>(values);
+          if (std::any_of(pred.dbl_values.begin(), pred.dbl_values.end(), [](double v) { return ISNAN(v); })) {
+            stop("NA is not allowed in where condition of column %s", name);
           }
-        } else {
-          for (auto i = 0; i < row_len; ++i) {
-            if (m_row_filter[i + offset]) {
-              if (arrow_array->IsNull(i)) {
-                rcpp_vec[filter_offset++] = NA;
-              } else {
-                convert_to_rvector(arrow_array, i, filter_offset, data, rcpp_vec);
-                filter_offset++;
-              }
-            }
+          sort_values(pred.dbl_values, pred.is_range);
+          break;
+        case arrow::Type::type::BINARY:
+        case arrow::Type::type::STRING:
+          if (TYPEOF(values) != STRSXP) {
+            stop("Where condition of column %s should be character", name);
           }
+          pred.str_values = as<std::vector<std::string>>(values);
+          sort_values(pred.str_values, pred.is_range);
+          break;
+        default:
+          stop("Unsupported column type in where condition, name:%s, type: %s",
+               name, m_col_types_names[pred.col_idx]);
+      }
+      m_predicates.push_back(pred);
+    }
+  }
+
+  // Skips the row groups whose statistics cannot match every predicate, and
+  // drops the non-matching rows from the selection of the remaining groups.
+  void apply_predicates() {
+    m_groups_skipped = 0;
+    if (m_predicates.empty()) {
+      return;
+    }
+    m_has_filter = true;
+    for (auto group_idx = 0; group_idx < m_row_groups; ++group_idx) {
+      auto group_metadata = m_file_metadata->RowGroup(group_idx);
+      bool keep = m_selection[group_idx].size(m_group_rows[group_idx]) != 0;
+      for (auto &pred : m_predicates) {
+        keep = keep && group_may_match(group_idx, *group_metadata, pred);
+      }
+      if (!keep) {
+        m_selection[group_idx] = Row_Selection{false, {}};
+        m_groups_skipped++;
+      } else {
+        for (auto &pred : m_predicates) {
+          match_rows(group_idx, pred);
         }
-      offset += row_len;
+      }
     }
   }
 
-private:
-  int m_row_selected_size;
-  int m_read_row_size;
-  int m_verbose;
-  int m_rows;
-  int m_cols;
-  int m_row_groups;
-  int m_rows_per_group;
-  int m_threads;
-  std::string                                 m_timezone;
-  std::string                                 m_filename;
-  std::vector<int>                            m_col_idx;
-  std::vector<int>                            m_row_filter;
-  std::unique_ptr<parquet::arrow::FileReader> m_reader;
-  std::vector<std::shared_ptr<arrow::Field>>  m_fields;
-  std::vector<int16_t>                        m_def_level;
-  std::vector<int16_t>                        m_repeat_level;
-  std::vector<uint8_t>                        m_valid_bits;
-  std::set<int>                               m_col_idx_set;
-  std::vector<std::string>                    m_col_names;
-  std::vector<arrow::Type::type>              m_col_types;
-  std::vector<std::string>                    m_col_types_names;
-  std::shared_ptr<arrow::Schema>              m_schema;
-  std::shared_ptr<arrow::Table>               m_table;
+  bool group_may_match(int group_idx, const parquet::RowGroupMetaData& group_metadata, const Column_Predicate& pred) {
+    std::shared_ptr<parquet::RowGroupStatistics> stats = m_cached_metadata->statistics(group_idx, pred.col_idx);
+    if (stats == nullptr) {
+      return true;
+    }
+    if (stats->null_count() == group_metadata.num_rows()) {
+      return false;
+    }
+    if (!stats->HasMinMax()) {
+      return true;
+    }
+    switch (m_file_metadata->schema()->Column(pred.col_idx)->physical_type()) {
+      case parquet::Type::BOOLEAN: {
+        auto typed_stats = std::static_pointer_cast<parquet::BoolStatistics>(stats);
+        return value_overlap<int64_t>(typed_stats->min(), typed_stats->max(), pred.int_values, pred.is_range);
+      }
+      case parquet::Type::INT32: {
+        auto typed_stats = std::static_pointer_cast<parquet::Int32Statistics>(stats);
+        return value_overlap<int64_t>(typed_stats->min(), typed_stats->max(), pred.int_values, pred.is_range);
+      }
+      case parquet::Type::INT64: {
+        auto typed_stats = std::static_pointer_cast<parquet::Int64Statistics>(stats);
+        return value_overlap<int64_t>(typed_stats->min(), typed_stats->max(), pred.int_values, pred.is_range);
+      }
+      case parquet::Type::DOUBLE: {
+        auto typed_stats = std::static_pointer_cast<parquet::DoubleStatistics>(stats);
+        return value_overlap<double>(typed_stats->min(), typed_stats->max(), pred.dbl_values, pred.is_range);
+      }
+      case parquet::Type::BYTE_ARRAY: {
+        auto typed_stats = std::static_pointer_cast<parquet::ByteArrayStatistics>(stats);
+        std::string min(reinterpret_cast<const char*>(typed_stats->min().ptr), typed_stats->min().len);
+        std::string max(reinterpret_cast<const char*>(typed_stats->max().ptr), typed_stats->max().len);
+        return value_overlap<std::string>(min, max, pred.str_values, pred.is_range);
+      }
+      default:
+        return true;
+    }
+  }
 
-};
-} // namespace RParquet
+  void match_rows(int group_idx, const Column_Predicate& pred) {
+    std::shared_ptr<arrow::Array> array = read_chunk(group_idx, pred.col_idx, "predicate");
+    switch (m_col_types[pred.col_idx]) {
+      case arrow::Type::type::INT32:
+        match_values<arrow::Int32Array>(array, pred.int_values, pred.is_range, m_selection[group_idx],
+            [](const arrow::Int32Array& ary, int64_t i) { return static_cast<int64_t>(ary.Value(i)); });
+        break;
+      case arrow::Type::type::INT64:
+        match_values<arrow::Int64Array>(array, pred.int_values, pred.is_range, m_selection[group_idx],
+            [](const arrow::Int64Array& ary, int64_t i) { return ary.Value(i); });
+        break;
+      case arrow::Type::type::TIMESTAMP:
+        match_values<arrow::TimestampArray>(array, pred.int_values, pred.is_range, m_selection[group_idx],
+            [](const arrow::TimestampArray& ary, int64_t i) { return ary.Value(i); });
+        break;
+      case arrow::Type::type::BOOL:
+        match_values<arrow::BooleanArray>(array, pred.int_values, pred.is_range, m_selection[group_idx],
+            [](const arrow::BooleanArray& ary, int64_t i) { return static_cast<int64_t>(ary.Value(i)); });
+        break;
+      case arrow::Type::type::DOUBLE:
+        match_values<arrow::DoubleArray>(array, pred.dbl_values, pred.is_range, m_selection[group_idx],
+            [](const arrow::DoubleArray& ary, int64_t i) { return ary.Value(i); });
+        break;
+      default:
+        match_values<arrow::StringArray>(array, pred.str_values, pred.is_range, m_selection[group_idx],
+            [](const arrow::StringArray& ary, int64_t i) { return ary.GetString(i); });
+        break;
+    }
+  }
 
-// [[Rcpp::export]]
-List read_parquet(std::string filename, IntegerVector selected_col, LogicalVector filter, int read_row_size, int threads, int verbose) {
-  RParquet::RParquet_Reader rp_reader(filename, selected_col, filter, read_row_size, threads, verbose);
-  rp_reader.init();
-  return rp_reader.create_df();
-}
+  template <typename ArrowArrayType, typename ValueType, typename FuncType>
+  void match_values(const std::shared_ptr<arrow::Array>& array, const std::vector<ValueType>& values,
+                    bool is_range, Row_Selection& selection, FuncType get_value) {
+    const ArrowArrayType& arrow_array = static_cast<const ArrowArrayType&>(*array);
+    auto matches = [&](int64_t i) {
+      return !arrow_array.IsNull(i) && value_match<ValueType>(get_value(arrow_array, i), values, is_range);
+    };
+    if (selection.all) {
+      selection.all = false;
+      for (int32_t i = 0; i < arrow_array.length(); ++i) {
+        if (matches(i)) {
+          selection.rows.push_back(i);
+        }
+      }
+      selection.normalize(arrow_array.length());
+    } else {
+      selection.rows.erase(std::remove_if(selection.rows.begin(), selection.rows.end(),
+                                          [&](int32_t i) { return !matches(i); }),
+                           selection.rows.end());
+    }
+  }
 
-// [[Rcpp::export]]
-DataFrame read_metadata(std::string filename, bool details = false) {
-  const std::string names[6] = {
-        "COL_NAME", "COL_PHY_TYPE", "COL_LOG_TYPE",
-        "COL_EMPTY_VALUES", "COL_TOTAL_COMPRESSED_SIZE",
-        "COL_TOTAL_UNCOMPRESSED_SIZE" };
-  std::vector <std::vector<std::string>> column_meta(6);
+  bool skip_group(int group_idx) {
+    return m_group_selected[group_idx] == 0;
+  }
 
-  DataFrame df = DataFrame::create();
-  std::unique_ptr<parquet::ParquetFileReader> parquet_reader = parquet::ParquetFileReader::OpenFile(filename, false);
-  std::shared_ptr<parquet::FileMetaData> file_metadata = parquet_reader->metadata();
-  int num_row_groups = file_metadata->num_row_groups();
-  int num_columns = file_metadata->num_columns();
+  bool is_string_col(int col_idx) {
+    return m_col_types[col_idx] == arrow::Type::type::STRING || m_col_types[col_idx] == arrow::Type::type::BINARY;
+  }
 
-  // File meta information
-  CharacterVector fmeta_vec;
-  fmeta_vec.push_back("Filename : " + filename);
-  fmeta_vec.push_back("Row Groups : " + std::to_string(num_row_groups));
-  fmeta_vec.push_back("Total Rows : " + std::to_string(file_metadata->num_rows()));
+  SEXP alloc_col(int col_idx, int capacity) {
+    switch(m_col_types[col_idx]) {
+      case arrow::Type::type::INT64:
+      case arrow::Type::type::TIMESTAMP: {
+        NumericVector nvec = NumericVector(capacity);
+        set_col_class(col_idx, nvec);
+        return nvec;
+      }
+      case arrow::Type::type::DOUBLE:
+        return NumericVector(capacity);
+      case arrow::Type::type::INT32:
+        return IntegerVector(capacity);
+      case arrow::Type::type::BOOL:
+        return LogicalVector(capacity);
+      case arrow::Type::type::BINARY:
+      case arrow::Type::type::STRING:
+        return CharacterVector(capacity);
+      default: {
+         stop("Unknown column, name:%s, type: %s",
+             m_col_names[col_idx], m_col_types_names[col_idx]);
+      }
+    }
+  }
+
+  // Type of the R vector a column is read into.
+  SEXPTYPE col_sexptype(int col_idx) {
+    switch(m_col_types[col_idx]) {
+      case arrow::Type::type::INT64:
+      case arrow::Type::type::DOUBLE:
+      case arrow::Type::type::TIMESTAMP:
+        return REALSXP;
+      case arrow::Type::type::INT32:
+        return INTSXP;
+      case arrow::Type::type::BOOL:
+        return LGLSXP;
+      case arrow::Type::type::BINARY:
+      case arrow::Type::type::STRING:
+        return STRSXP;
+      default: {
+         stop("Unknown column, name:%s, type: %s",
+             m_col_names[col_idx], m_col_types_names[col_idx]);
+      }
+    }
+  }
+
+  void set_col_class(int col_idx, SEXP vec) {
+    set_type_class(m_col_types[col_idx], vec);
+  }
+
+  // integer64 and nanotime keep their int64 values in the bits of a double
+  // vector, told apart by the class.
+  static void set_type_class(arrow::Type::type type, SEXP vec) {
+    RObject obj(vec);
+    if (type == arrow::Type::type::INT64) {
+      obj.attr("class") = "integer64";
+    } else if (type == arrow::Type::type::TIMESTAMP) {
+      Rcpp::CharacterVector cl = Rcpp::CharacterVector::create("nanotime");
+      cl.attr("package") = "nanotime";
+      obj.attr(".S3Class") = "integer64";
+      obj.attr("class") = cl;
+      SET_S4_OBJECT(vec);
+    }
+  }
+
+  // Adds the tasks filling the row groups [first_group, last_group) of a fixed
+  // width column, the first selected row going to out_offset in the R vector.
+  void add_col_tasks(int col_idx, int first_group, int last_group, SEXP vec, int64_t out_offset,
+                     std::vector<std::function<void()>>& tasks) {
+    for (auto group_idx = first_group; group_idx < last_group; ++group_idx) {
+      if (!skip_group(group_idx)) {
+        int64_t group_offset = m_group_out_offset[group_idx] - m_group_out_offset[first_group] + out_offset;
+        tasks.push_back(col_task(col_idx, group_idx, vec, group_offset));
+      }
+    }
+  }
+
+  // Returns the task filling one row group of a fixed width column, starting
+  // at out_offset in the R vector. Only raw pointers into the R vector are
+  // captured, so it can run on a worker thread.
+  std::function<void()> col_task(int col_idx, int group_idx, SEXP vec, int64_t out_offset) {
+    Chunk_Converter convert = col_converter(col_idx, group_idx, vec, out_offset);
+    return [=]() { convert(*read_rows(group_idx, col_idx)); };
+  }
+
+  // Returns the function converting the decoded chunk of one row group of a
+  // fixed width column into the R vector from out_offset on.
+  Chunk_Converter col_converter(int col_idx, int group_idx, SEXP vec, int64_t out_offset) {
+    switch(m_col_types[col_idx]) {
+      case arrow::Type::type::INT64: {
+        // integer64 is stored as int64 bits in the double vector.
+        int64_t* out = reinterpret_cast<int64_t*>(REAL(vec)) + out_offset;
+        return [=](const arrow::Array& array) {
+          copy_row_group<arrow::Int64Array>(array, group_idx, col_idx, NA_INTEGER64, out);
+        };
+      }
+      case arrow::Type::type::DOUBLE: {
+        double* out = REAL(vec) + out_offset;
+        double na = NA_REAL;
+        return [=](const arrow::Array& array) { copy_row_group<arrow::DoubleArray>(array, group_idx, col_idx, na, out); };
+      }
+      case arrow::Type::type::INT32: {
+        int* out = INTEGER(vec) + out_offset;
+        return [=](const arrow::Array& array) {
+          copy_row_group<arrow::Int32Array>(array, group_idx, col_idx, NA_INTEGER, out);
+        };
+      }
+      case arrow::Type::type::BOOL: {
+        int* out = LOGICAL(vec) + out_offset;
+        return [=](const arrow::Array& array) {
+          read_row_group<arrow::BooleanArray>(array, group_idx, col_idx, NA_LOGICAL, out,
+            [](const arrow::BooleanArray& arrow_ary, int64_t i) { return static_cast<int>(arrow_ary.Value(i)); });
+        };
+      }
+      default: {
+        // nanotime is stored as integer64 bits in the double vector.
+        int64_t* out = reinterpret_cast<int64_t*>(REAL(vec)) + out_offset;
+        return [=](const arrow::Array& array) { scale_row_group(array, group_idx, col_idx, NA_INTEGER64, out); };
+      }
+    }
+  }
+
+  // Asks the OS to read ahead the byte ranges of the selected column chunks of
+  // the row groups [first_group, last_group), so the reads of the workers find
+  // them in the page cache. Only a hint, nothing is read here.
+  void prefetch_chunks(int first_group, int last_group) {
+#if !defined(_WIN32) && defined(POSIX_FADV_WILLNEED)
+    int fd = ::open(m_filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return;
+    }
+    for (auto group_idx = first_group; group_idx < last_group; ++group_idx) {
+      if (skip_group(group_idx)) {
+        continue;
+      }
+      auto group_metadata = m_file_metadata->RowGroup(group_idx);
+      for (auto &col_idx : m_col_idx_set) {
+        auto column_chunk = group_metadata->ColumnChunk(col_idx - 1);
+        int64_t start = column_chunk->data_page_offset();
+        if (column_chunk->has_dictionary_page() && column_chunk->dictionary_page_offset() > 0) {
+          start = std::min(start, column_chunk->dictionary_page_offset());
+        }
+        posix_fadvise(fd, start, column_chunk->total_compressed_size(), POSIX_FADV_WILLNEED);
+      }
+    }
+    ::close(fd);
+#endif
+  }
+
+  // Adds the tasks decoding the chunks of the row groups [first_group,
+  // last_group) of a column into arrays, indexed by row group. A chunk may
+  // hold only its selected rows, see read_rows().
+  void add_chunk_tasks(int col_idx, int first_group, int last_group,
+                       std::vector<std::shared_ptr<arrow::Array>>& arrays,
+                       std::vector<std::function<void()>>& tasks) {
+    for (auto group_idx = first_group; group_idx < last_group; ++group_idx) {
+      if (!skip_group(group_idx)) {
+        tasks.push_back([this, col_idx, group_idx, &arrays]() {
+          arrays[group_idx] = read_rows(group_idx, col_idx);
+        });
+      }
+    }
+  }
+
+  // Decodes the chunks of the row groups [first_group, last_group) of a column
+  // on the workers.
+  std::vector<std::shared_ptr<arrow::Array>> read_chunks(int col_idx, int first_group, int last_group) {
+    std::vector<std::shared_ptr<arrow::Array>> arrays(m_row_groups);
+    std::vector<std::function<void()>> tasks;
+    add_chunk_tasks(col_idx, first_group, last_group, arrays, tasks);
+    run_tasks(tasks, m_threads);
+    return arrays;
+  }
+
+  // Hands out the decoded chunks by row group, each one once.
+  static Chunk_Source chunk_source(std::vector<std::shared_ptr<arrow::Array>>& arrays) {
+    return [&arrays](int group_idx) { return std::move(arrays[group_idx]); };
+  }
+
+  // Starts decoding the chunks of the columns of the row groups [first_group,
+  // last_group) with selected rows on background threads, in the order they
+  // are taken: column by column, row group by row group. The uncompressed
+  // size of a chunk is its cost against the memory budget.
+  std::unique_ptr<Chunk_Pipeline> chunk_pipeline(const std::vector<int>& cols, int first_group, int last_group) {
+    std::vector<std::function<std::shared_ptr<arrow::Array>()>> tasks;
+    std::vector<int64_t> costs;
+    add_pipeline_tasks(cols, first_group, last_group, tasks, costs);
+    return std::unique_ptr<Chunk_Pipeline>(new Chunk_Pipeline(std::move(tasks), std::move(costs), m_threads,
+                                                              m_pipeline_depth, m_pipeline_memory));
+  }
+
+  // Adds the tasks of a chunk pipeline decoding the chunks of the columns,
+  // see chunk_pipeline(), with their costs.
+  void add_pipeline_tasks(const std::vector<int>& cols, int first_group, int last_group,
+                          std::vector<std::function<std::shared_ptr<arrow::Array>()>>& tasks,
+                          std::vector<int64_t>& costs) {
+    for (auto &col_idx : cols) {
+      for (auto group_idx = first_group; group_idx < last_group; ++group_idx) {
+        if (!skip_group(group_idx)) {
+          tasks.push_back([this, col_idx, group_idx]() { return read_rows(group_idx, col_idx); });
+          costs.push_back(m_file_metadata->RowGroup(group_idx)->ColumnChunk(col_idx)->total_uncompressed_size());
+        }
+      }
+    }
+  }
+
+  // Reads a string column as a factor: rows are turned into codes from the
+  // value bytes and only the levels become R strings.
+  SEXP read_factor_col(int col_idx, int capacity, int first_group, int last_group) {
+    IntegerVector ivec = IntegerVector(capacity);
+    Factor_Levels levels;
+    read_factor_codes(col_idx, INTEGER(ivec), levels, first_group, last_group);
+    set_factor_levels(ivec, levels, m_col_types[col_idx] == arrow::Type::type::STRING ? CE_UTF8 : CE_NATIVE);
+    return ivec;
+  }
+
+  // The factor codes of a string column, without R calls. The chunks come
+  // from source, or are all decoded at once without it.
+  void read_factor_codes(int col_idx, int* codes, Factor_Levels& levels, int first_group, int last_group,
+                         Chunk_Source source = nullptr) {
+    std::vector<std::shared_ptr<arrow::Array>> arrays;
+    if (!source) {
+      arrays = read_chunks(col_idx, first_group, last_group);
+      source = chunk_source(arrays);
+    }
+    fill_factor_codes(col_idx, source, codes, 0, levels, first_group, last_group);
+  }
+
+  // Turns the decoded chunks into factor codes from out_offset on, releasing
+  // each chunk once it is done. levels may be shared between calls.
+  void fill_factor_codes(int col_idx, const Chunk_Source& source, int* codes,
+                         int64_t out_offset, Factor_Levels& levels, int first_group, int last_group) {
+    for (auto group_idx = first_group; group_idx < last_group; ++group_idx) {
+      if (skip_group(group_idx)) {
+        continue;
+      }
+      std::shared_ptr<arrow::Array> array = source(group_idx);
+      Profile::Time_Point start = Profile::now();
+      const arrow::BinaryArray& arrow_array = static_cast<const arrow::BinaryArray&>(*array);
+      auto row_len = arrow_array.length();
+      auto filter_offset = m_group_out_offset[group_idx] - m_group_out_offset[first_group] + out_offset;
+      auto to_code = [&](int64_t i) {
+        if (arrow_array.IsNull(i)) {
+          return NA_INTEGER;
+        }
+        int32_t len;
+        const uint8_t* data = arrow_array.GetValue(i, &len);
+        return levels.code(reinterpret_cast<const char*>(data), len);
+      };
+      const Row_Selection& selection = m_selection[group_idx];
+      if (dense_rows(group_idx, arrow_array)) {
+        for (auto i = 0; i < row_len; ++i) {
+          codes[i + filter_offset] = to_code(i);
+        }
+      } else {
+        for (auto &i : selection.rows) {
+          codes[filter_offset++] = to_code(i);
+        }
+      }
+      profile_phase("convert", col_idx, group_idx, start, -1, m_group_selected[group_idx]);
+    }
+  }
+
+  // Levels come in the order first read, they are sorted as factor() would
+  // (by the collation of the locale) and the codes remapped when needed.
+  static void set_factor_levels(IntegerVector& ivec, const Factor_Levels& levels, cetype_t encoding) {
+    R_xlen_t level_size = levels.levels().size();
+    CharacterVector level_vec(level_size);
+    for (R_xlen_t i = 0; i < level_size; ++i) {
+      const std::string& level = levels.levels()[i];
+      SET_STRING_ELT(level_vec, i, Rf_mkCharLenCE(level.data(), level.size(), encoding));
+    }
+    IntegerVector order = Function("order", R_BaseEnv)(level_vec);
+    if (std::is_sorted(order.begin(), order.end())) {
+      ivec.attr("levels") = level_vec;
+    } else {
+      std::vector<int> rank(level_size + 1);
+      CharacterVector sorted_levels(level_size);
+      for (R_xlen_t i = 0; i < level_size; ++i) {
+        rank[order[i]] = i + 1;
+        SET_STRING_ELT(sorted_levels, i, STRING_ELT(level_vec, order[i] - 1));
+      }
+      int* codes = INTEGER(ivec);
+      for (R_xlen_t i = 0; i < ivec.size(); ++i) {
+        if (codes[i] != NA_INTEGER) {
+          codes[i] = rank[codes[i]];
+        }
+      }
+      ivec.attr("levels") = sorted_levels;
+    }
+    ivec.attr("class") = "factor";
+  }
+
+  // True if the string column is read as a factor.
+  bool is_factor_col(int col_idx) {
+    return m_as_factor && is_dictionary_col(col_idx);
+  }
+
+  // True if the column chunks are dictionary encoded in the file, in which
+  // case the column has few distinct values worth caching as CHARSXPs.
+  bool is_dictionary_col(int col_idx) {
+    for (auto group_idx = 0; group_idx < m_row_groups; ++group_idx) {
+      if (m_file_metadata->RowGroup(group_idx)->ColumnChunk(col_idx)->has_dictionary_page()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // The CHARSXPs are made from the arrow offsets/data buffers directly, a
+  // dictionary encoded column goes through a CharSXP_Cache so each distinct
+  // value is made once.
+  void read_string_col(int col_idx, SEXP cvec, int first_group, int last_group, Chunk_Source source = nullptr) {
+    std::vector<std::shared_ptr<arrow::Array>> arrays;
+    if (!source) {
+      arrays = read_chunks(col_idx, first_group, last_group);
+      source = chunk_source(arrays);
+    }
+    CharSXP_Cache cache = string_cache(col_idx);
+    fill_string_col(col_idx, source, cvec, 0, cache, first_group, last_group);
+  }
+
+  CharSXP_Cache string_cache(int col_idx) {
+    return CharSXP_Cache(is_dictionary_col(col_idx) ? m_max_cached_strings : 0,
+                         m_col_types[col_idx] == arrow::Type::type::STRING ? CE_UTF8 : CE_NATIVE);
+  }
+
+  // Sets the decoded chunks into the character vector from out_offset on,
+  // releasing each chunk once it is done. The CHARSXPs of a chunk are made
+  // under unwind_protect(), so a pipeline feeding source is still joined when
+  // R jumps out.
+  void fill_string_col(int col_idx, const Chunk_Source& source, SEXP cvec,
+                       int64_t out_offset, CharSXP_Cache& cache, int first_group, int last_group) {
+    for (auto group_idx = first_group; group_idx < last_group; ++group_idx) {
+      if (skip_group(group_idx)) {
+        continue;
+      }
+      std::shared_ptr<arrow::Array> array = source(group_idx);
+      Profile::Time_Point start = Profile::now();
+      const arrow::BinaryArray& arrow_array = static_cast<const arrow::BinaryArray&>(*array);
+      auto row_len = arrow_array.length();
+      auto filter_offset = m_group_out_offset[group_idx] - m_group_out_offset[first_group] + out_offset;
+      auto to_charsxp = [&](int64_t i) {
+        if (arrow_array.IsNull(i)) {
+          return NA_STRING;
+        }
+        int32_t len;
+        const uint8_t* data = arrow_array.GetValue(i, &len);
+        return cache.get(reinterpret_cast<const char*>(data), len);
+      };
+      const Row_Selection& selection = m_selection[group_idx];
+      bool dense = dense_rows(group_idx, arrow_array);
+      unwind_protect([&]() {
+        if (dense) {
+          for (auto i = 0; i < row_len; ++i) {
+            SET_STRING_ELT(cvec, i + filter_offset, to_charsxp(i));
+          }
+        } else {
+          for (auto &i : selection.rows) {
+            SET_STRING_ELT(cvec, filter_offset++, to_charsxp(i));
+          }
+        }
+      });
+      profile_phase("convert", col_idx, group_idx, start, -1, m_group_selected[group_idx]);
+    }
+  }
+
+  // Fixed width column whose R value has the width of the arrow value (INT32
+  // into integer, DOUBLE into numeric, INT64 bits into integer64): the chunk
+  // is block copied and its nulls patched from the validity bitmap. Runs on
+  // worker threads: no R API calls here.
+  template <typename ArrowArrayType, typename ValueType>
+  void copy_row_group(const arrow::Array& array, int group_idx, int col_idx, ValueType NA, ValueType* rvec) {
+    using CType = typename ArrowArrayType::TypeClass::c_type;
+    static_assert(sizeof(CType) == sizeof(ValueType), "R value and arrow value should have the same width");
+    Profile::Time_Point start = Profile::now();
+    const ArrowArrayType& arrow_array = static_cast<const ArrowArrayType&>(array);
+    const CType* data = arrow_array.raw_values();
+    auto row_len = arrow_array.length();
+    const Row_Selection& selection = m_selection[group_idx];
+    if (dense_rows(group_idx, arrow_array)) {
+      std::memcpy(rvec, data, row_len * sizeof(ValueType));
+      profile_phase("convert", col_idx, group_idx, start, -1, row_len);
+      start = Profile::now();
+      patch_nulls(arrow_array, NA, rvec);
+      profile_phase("na_patch", col_idx, group_idx, start, -1, arrow_array.null_count());
+    } else {
+      bool has_nulls = arrow_array.null_count() != 0;
+      int64_t filter_offset = 0;
+      for (auto &i : selection.rows) {
+        if (has_nulls && arrow_array.IsNull(i)) {
+          rvec[filter_offset++] = NA;
+        } else {
+          std::memcpy(rvec + filter_offset++, data + i, sizeof(ValueType));
+        }
+      }
+      profile_phase("convert", col_idx, group_idx, start, -1, filter_offset);
+    }
+  }
+
+  // TIMESTAMP column into nanotime: the unit is resolved once per chunk and
+  // the values are scaled to nanoseconds in one pass.
+  void scale_row_group(const arrow::Array& array, int group_idx, int col_idx, int64_t NA, int64_t* rvec) {
+    Profile::Time_Point start = Profile::now();
+    const arrow::TimestampArray& arrow_array = static_cast<const arrow::TimestampArray&>(array);
+    const int64_t scale = ticks_per_unit(static_cast<const arrow::TimestampType&>(*arrow_array.type()).unit());
+    const int64_t* data = arrow_array.raw_values();
+    auto row_len = arrow_array.length();
+    const Row_Selection& selection = m_selection[group_idx];
+    if (dense_rows(group_idx, arrow_array)) {
+      for (int64_t i = 0; i < row_len; ++i) {
+        rvec[i] = data[i] * scale;
+      }
+      profile_phase("convert", col_idx, group_idx, start, -1, row_len);
+      start = Profile::now();
+      patch_nulls(arrow_array, NA, rvec);
+      profile_phase("na_patch", col_idx, group_idx, start, -1, arrow_array.null_count());
+    } else {
+      bool has_nulls = arrow_array.null_count() != 0;
+      int64_t filter_offset = 0;
+      for (auto &i : selection.rows) {
+        rvec[filter_offset++] = (has_nulls && arrow_array.IsNull(i)) ? NA : data[i] * scale;
+      }
+      profile_phase("convert", col_idx, group_idx, start, -1, filter_offset);
+    }
+  }
+
+  // Converts the selected rows of a decoded column chunk into out. Runs on
+  // worker threads: no R API calls here.
+  template <typename ArrowArrayType, typename ValueType, typename FuncType>
+  void read_row_group(const arrow::Array& array, int group_idx, int col_idx, ValueType NA, ValueType* rvec,
+                      FuncType convert_to_rvalue) {
+    Profile::Time_Point start = Profile::now();
+    const ArrowArrayType& arrow_array = static_cast<const ArrowArrayType&>(array);
+    auto row_len = arrow_array.length();
+    const Row_Selection& selection = m_selection[group_idx];
+    if (dense_rows(group_idx, arrow_array)) {
+      for (auto i = 0; i < row_len; ++i) {
+        rvec[i] = arrow_array.IsNull(i) ? NA : convert_to_rvalue(arrow_array, i);
+      }
+    } else {
+      int64_t filter_offset = 0;
+      for (auto &i : selection.rows) {
+        rvec[filter_offset++] = arrow_array.IsNull(i) ? NA : convert_to_rvalue(arrow_array, i);
+      }
+    }
+    profile_phase("convert", col_idx, group_idx, start, -1, m_group_selected[group_idx]);
+  }
+
+  // The rows of a column chunk to convert: only the selected ones when they
+  // are few enough for range reads to pay off, otherwise the whole chunk.
+  std::shared_ptr<arrow::Array> read_rows(int group_idx, int col_idx) {
+    return range_readable(group_idx, col_idx) ? read_selected_rows(group_idx, col_idx) : read_chunk(group_idx, col_idx);
+  }
+
+  // True if the array holds the rows to convert in order: the whole row group
+  // when all its rows are selected, or its selected rows alone when it comes
+  // from read_selected_rows(). A selection that is not all of the row group
+  // has fewer rows than it, so the two cases can not be mistaken.
+  bool dense_rows(int group_idx, const arrow::Array& array) {
+    return m_selection[group_idx].all || array.length() != m_group_rows[group_idx];
+  }
+
+  // Range reads are done for at most one selected row out of
+  // m_range_read_ratio, on flat columns whose arrow type is the one of their
+  // physical type (INT96 and converted types go through the arrow reader).
+  bool range_readable(int group_idx, int col_idx) {
+    const Row_Selection& selection = m_selection[group_idx];
+    if (selection.all ||
+        static_cast<int64_t>(selection.rows.size()) * m_range_read_ratio > m_group_rows[group_idx]) {
+      return false;
+    }
+    const parquet::ColumnDescriptor* descr = m_file_metadata->schema()->Column(col_idx);
+    if (descr->max_repetition_level() != 0 || descr->max_definition_level() > 1) {
+      return false;
+    }
+    switch (m_col_types[col_idx]) {
+      case arrow::Type::type::INT32:
+        return descr->physical_type() == parquet::Type::INT32;
+      case arrow::Type::type::INT64:
+      case arrow::Type::type::TIMESTAMP:
+        return descr->physical_type() == parquet::Type::INT64;
+      case arrow::Type::type::DOUBLE:
+        return descr->physical_type() == parquet::Type::DOUBLE;
+      case arrow::Type::type::BOOL:
+        return descr->physical_type() == parquet::Type::BOOLEAN;
+      case arrow::Type::type::BINARY:
+      case arrow::Type::type::STRING:
+        return descr->physical_type() == parquet::Type::BYTE_ARRAY;
+      default:
+        return false;
+    }
+  }
+
+  // Decodes the selected rows of a column chunk alone into an array of the
+  // arrow type of the column. The rows between two runs of selected rows are
+  // skipped by the column reader, which drops whole pages without decoding
+  // them. parquet-cpp has no page index, so the pages are still read and
+  // decompressed. Runs on worker threads: no R API calls here.
+  std::shared_ptr<arrow::Array> read_selected_rows(int group_idx, int col_idx) {
+    Profile::Time_Point start = Profile::now();
+    const std::vector<int32_t>& rows = m_selection[group_idx].rows;
+    int64_t length = rows.size();
+    std::shared_ptr<parquet::ColumnReader> column_reader =
+      m_reader->parquet_reader()->RowGroup(group_idx)->Column(col_idx);
+    std::shared_ptr<arrow::Buffer> valid_bits = allocate_buffer(arrow::BitUtil::BytesForBits(length));
+    uint8_t* valid = valid_bits->mutable_data();
+    int64_t null_count = 0;
+    std::vector<std::shared_ptr<arrow::Buffer>> buffers;
+    switch (column_reader->type()) {
+      case parquet::Type::INT32:
+        buffers = {valid_bits, read_fixed_rows<parquet::Int32Type>(column_reader.get(), rows, valid, &null_count)};
+        break;
+      case parquet::Type::INT64:
+        buffers = {valid_bits, read_fixed_rows<parquet::Int64Type>(column_reader.get(), rows, valid, &null_count)};
+        break;
+      case parquet::Type::DOUBLE:
+        buffers = {valid_bits, read_fixed_rows<parquet::DoubleType>(column_reader.get(), rows, valid, &null_count)};
+        break;
+      case parquet::Type::BOOLEAN: {
+        // Arrow booleans are bits.
+        std::shared_ptr<arrow::Buffer> values = allocate_buffer(arrow::BitUtil::BytesForBits(length));
+        uint8_t* data = values->mutable_data();
+        std::memset(data, 0, values->size());
+        null_count = read_row_runs<parquet::BooleanType>(column_reader.get(), rows, valid,
+          [&](int64_t out, const bool* batch, int64_t n) {
+            for (int64_t i = 0; i < n; ++i) {
+              if (batch[i]) {
+                arrow::BitUtil::SetBit(data, out + i);
+              }
+            }
+          });
+        buffers = {valid_bits, values};
+        break;
+      }
+      default: {
+        // The bytes of a value point into the current page, they are copied
+        // before the next batch is read.
+        std::shared_ptr<arrow::Buffer> offsets = allocate_buffer((length + 1) * sizeof(int32_t));
+        int32_t* offset = reinterpret_cast<int32_t*>(offsets->mutable_data());
+        offset[0] = 0;
+        arrow::BufferBuilder bytes(memory_pool());
+        null_count = read_row_runs<parquet::ByteArrayType>(column_reader.get(), rows, valid,
+          [&](int64_t out, const parquet::ByteArray* batch, int64_t n) {
+            for (int64_t i = 0; i < n; ++i) {
+              int32_t len = 0;
+              if (arrow::BitUtil::GetBit(valid, out + i)) {
+                len = batch[i].len;
+                PARQUET_THROW_NOT_OK(bytes.Append(batch[i].ptr, len));
+              }
+              offset[out + i + 1] = offset[out + i] + len;
+            }
+          });
+        std::shared_ptr<arrow::Buffer> data;
+        PARQUET_THROW_NOT_OK(bytes.Finish(&data));
+        buffers = {valid_bits, offsets, data};
+        break;
+      }
+    }
+    std::shared_ptr<arrow::Array> array =
+      arrow::MakeArray(arrow::ArrayData::Make(m_fields[col_idx]->type(), length, std::move(buffers), null_count));
+    if (m_profile) {
+      auto column_chunk = m_file_metadata->RowGroup(group_idx)->ColumnChunk(col_idx);
+      m_profile->add("decode", col_idx, group_idx, Profile::since(start), column_chunk->total_compressed_size(),
+                     length);
+      m_profile->add("decompress", col_idx, group_idx, -1, column_chunk->total_uncompressed_size());
+    }
+    return array;
+  }
+
+  // Values of a fixed width physical type for the selected rows.
+  template <typename DType>
+  std::shared_ptr<arrow::Buffer> read_fixed_rows(parquet::ColumnReader* column_reader,
+                                                 const std::vector<int32_t>& rows, uint8_t* valid_bits,
+                                                 int64_t* null_count) {
+    using T = typename DType::c_type;
+    std::shared_ptr<arrow::Buffer> values = allocate_buffer(rows.size() * sizeof(T));
+    T* data = reinterpret_cast<T*>(values->mutable_data());
+    *null_count = read_row_runs<DType>(column_reader, rows, valid_bits,
+      [&](int64_t out, const T* batch, int64_t n) { std::memcpy(data + out, batch, n * sizeof(T)); });
+    return values;
+  }
+
+  // Walks the runs of consecutive selected rows, skipping the rows before
+  // each run and decoding the run at most m_read_row_size values at a time.
+  // store(out, values, n) gets the n values decoded for the selected rows
+  // from out on, with undefined values in the null slots, whose validity
+  // bits are set in valid_bits. Returns the number of nulls.
+  template <typename DType, typename FuncType>
+  int64_t read_row_runs(parquet::ColumnReader* column_reader, const std::vector<int32_t>& rows,
+                        uint8_t* valid_bits, FuncType store) {
+    using T = typename DType::c_type;
+    auto reader = static_cast<parquet::TypedColumnReader<DType>*>(column_reader);
+    int64_t batch_size = std::min<int64_t>(m_read_row_size, rows.size());
+    std::unique_ptr<T[]> values(new T[batch_size]);
+    std::vector<int16_t> def_levels(batch_size);
+    int64_t null_count = 0;
+    int64_t next_row = 0;
+    size_t first = 0;
+    while (first < rows.size()) {
+      size_t last = first + 1;
+      while (last < rows.size() && rows[last] == rows[last - 1] + 1) {
+        ++last;
+      }
+      if (rows[first] > next_row && reader->Skip(rows[first] - next_row) != rows[first] - next_row) {
+        throw parquet::ParquetException("Unexpected end of column chunk");
+      }
+      int64_t out = first;
+      while (out < static_cast<int64_t>(last)) {
+        int64_t levels_read = 0;
+        int64_t values_read = 0;
+        int64_t nulls = 0;
+        reader->ReadBatchSpaced(std::min<int64_t>(last - out, batch_size), def_levels.data(), nullptr,
+                                values.get(), valid_bits, out, &levels_read, &values_read, &nulls);
+        if (values_read == 0) {
+          throw parquet::ParquetException("Unexpected end of column chunk");
+        }
+        store(out, values.get(), values_read);
+        out += values_read;
+        null_count += nulls;
+      }
+      next_row = rows[last - 1] + 1;
+      first = last;
+    }
+    return null_count;
+  }
+
+  static std::shared_ptr<arrow::Buffer> allocate_buffer(int64_t size) {
+    std::shared_ptr<arrow::Buffer> buffer;
+    PARQUET_THROW_NOT_OK(arrow::AllocateBuffer(memory_pool(), size, &buffer));
+    return buffer;
+  }
+
+  // Decodes a column chunk: parquet-cpp reads, decompresses and decodes its
+  // pages in one call, so the profile has one phase for the three, with the
+  // bytes read from the file, and the uncompressed bytes as "decompress".
+  std::shared_ptr<arrow::Array> read_chunk(int group_idx, int col_idx, const char* phase = "decode") {
+    Profile::Time_Point start = Profile::now();
+    std::shared_ptr<arrow::Array> array;
+    PARQUET_THROW_NOT_OK(m_reader->RowGroup(group_idx)->Column(col_idx)->Read(&array));
+    if (m_profile) {
+      auto column_chunk = m_file_metadata->RowGroup(group_idx)->ColumnChunk(col_idx);
+      m_profile->add(phase, col_idx, group_idx, Profile::since(start), column_chunk->total_compressed_size(),
+                     array->length());
+      m_profile->add("decompress", col_idx, group_idx, -1, column_chunk->total_uncompressed_size());
+    }
+    return array;
+  }
+
+  void profile_phase(const char* phase, int col_idx, int group_idx, Profile::Time_Point start,
+                     int64_t bytes = -1, int64_t rows = -1) {
+    if (m_profile) {
+      m_profile->add(phase, col_idx, group_idx, Profile::since(start), bytes, rows);
+    }
+  }
+
+  static int64_t r_vector_bytes(SEXP vec) {
+    switch (TYPEOF(vec)) {
+      case REALSXP:
+        return Rf_xlength(vec) * sizeof(double);
+      case STRSXP:
+        return Rf_xlength(vec) * sizeof(SEXP);
+      default:
+        return Rf_xlength(vec) * sizeof(int);
+    }
+  }
+
+  const std::string& filename() const {
+    return m_filename;
+  }
+
+  const std::set<int>& col_idx_set() const {
+    return m_col_idx_set;
+  }
+
+  const std::string& col_name(int col_idx) const {
+    return m_col_names[col_idx];
+  }
+
+  arrow::Type::type col_type(int col_idx) const {
+    return m_col_types[col_idx];
+  }
+
+  int row_groups() const {
+    return m_row_groups;
+  }
+
+  int groups_skipped() const {
+    return m_groups_skipped;
+  }
+
+  int selected_rows() const {
+    return m_row_selected_size;
+  }
+
+  bool prefetch() const {
+    return m_prefetch;
+  }
+
+  int threads() const {
+    return m_threads;
+  }
+
+  int pipeline_depth() const {
+    return m_pipeline_depth;
+  }
+
+  int64_t pipeline_memory() const {
+    return m_pipeline_memory;
+  }
+
+  // First output row of each row group.
+  const std::vector<int64_t>& group_out_offsets() const {
+    return m_group_out_offset;
+  }
+
+  const Row_Selection& selection(int group_idx) const {
+    return m_selection[group_idx];
+  }
+
+  int64_t group_rows(int group_idx) const {
+    return m_group_rows[group_idx];
+  }
+
+  // Statistics of a column chunk, null when the file has none.
+  std::shared_ptr<parquet::RowGroupStatistics> statistics(int group_idx, int col_idx) {
+    return m_cached_metadata->statistics(group_idx, col_idx);
+  }
+
+  parquet::Type::type physical_type(int col_idx) const {
+    return m_file_metadata->schema()->Column(col_idx)->physical_type();
+  }
+
+  // Nanoseconds per value of a timestamp column, 1 for the other columns.
+  int64_t col_scale(int col_idx) const {
+    if (m_col_types[col_idx] != arrow::Type::type::TIMESTAMP) {
+      return 1;
+    }
+    return ticks_per_unit(std::static_pointer_cast<arrow::TimestampType>(m_fields[col_idx]->type())->unit());
+  }
+
+  // The profile gathered so far, after which profiling stops. Null when not
+  // profiling.
+  SEXP take_profile() {
+    if (!m_profile) {
+      return R_NilValue;
+    }
+    DataFrame profile = m_profile->take(m_col_names);
+    m_profile.reset();
+    return profile;
+  }
+
+private:
+  bool m_has_filter;
+  bool m_as_factor;
+  bool m_mmap;
+  bool m_prefetch;
+  double m_buffer_size;
+  int m_pipeline_depth;
+  int64_t m_pipeline_memory;
+  static const int m_default_pipeline_depth = 4;
+  static const int64_t m_default_pipeline_memory = 256 << 20;
+  int m_groups_skipped;
+  int m_next_group;
+  static const size_t m_max_cached_strings = 1 << 20;
+  static const int64_t m_range_read_ratio = 8;
+  int m_row_selected_size;
+  int m_read_row_size;
+  int m_verbose;
+  int m_rows;
+  int m_cols;
+  int m_row_groups;
+  int m_rows_per_group;
+  int m_threads;
+  std::string                                 m_timezone;
+  std::string                                 m_filename;
+  std::vector<int>                            m_col_idx;
+  LogicalVector                               m_filter;
+  List                                        m_where;
+  NumericVector                               m_row_from;
+  NumericVector                               m_row_to;
+  std::vector<Row_Selection>                  m_selection;
+  std::vector<Column_Predicate>               m_predicates;
+  std::vector<int64_t>                        m_group_selected;
+  std::vector<int64_t>                        m_group_row_offset;
+  std::vector<int64_t>                        m_group_out_offset;
+  std::shared_ptr<Cached_Metadata>            m_cached_metadata;
+  std::shared_ptr<parquet::FileMetaData>      m_file_metadata;
+  std::unique_ptr<parquet::arrow::FileReader> m_reader;
+  std::vector<std::shared_ptr<arrow::Field>>  m_fields;
+  std::vector<int16_t>                        m_def_level;
+  std::vector<int16_t>                        m_repeat_level;
+  std::vector<uint8_t>                        m_valid_bits;
+  std::set<int>                               m_col_idx_set;
+  std::vector<std::string>                    m_col_names;
+  std::vector<arrow::Type::type>              m_col_types;
+  std::vector<std::string>                    m_col_types_names;
+  std::vector<int64_t>                        m_group_rows;
+  std::shared_ptr<arrow::Schema>              m_schema;
+  std::unique_ptr<Profile>                    m_profile;
+
+};
+
+// Reads several files with the same selected columns into one data frame.
+// Every file is planned by its own reader (row selection and row groups
+// skipped by the where conditions), then the R vectors are allocated once for
+// all the selected rows and the row groups of the files are decoded by one
+// pool of workers, each into its slice of the vectors. The readers keep their
+// file closed between planning and decoding, and at most m_max_open_files
+// files are open at a time.
+class RParquet_Dataset {
+public:
+  RParquet_Dataset(CharacterVector filenames,
+                   IntegerVector selected_col,
+                   List where,
+                   bool as_factor,
+                   int threads,
+                   List io_options,
+                   int verbose
+                   ) :
+    m_filenames(as<std::vector<std::string>>(filenames)),
+    m_selected_col(selected_col),
+    m_where(where),
+    m_as_factor(as_factor),
+    m_threads(threads),
+    m_io_options(io_options),
+    m_verbose(verbose),
+    m_rows(0) {
+  }
+
+  void init() {
+    if (m_filenames.empty()) {
+      stop("No file to read.");
+    }
+    int64_t rows = 0;
+    for (auto &filename : m_filenames) {
+      std::unique_ptr<RParquet_Reader> reader(
+          new RParquet_Reader(filename, m_selected_col, LogicalVector::create(TRUE), m_where, NumericVector(),
+                              NumericVector(), m_as_factor, m_read_row_size, m_threads, m_io_options, false, 0));
+      reader->init();
+      reader->close_file();
+      if (!m_readers.empty() && !same_columns(*m_readers.front(), *reader)) {
+        stop("The selected columns of %s do not match those of %s", filename, m_filenames.front());
+      }
+      m_file_offset.push_back(rows);
+      rows += reader->selected_rows();
+      m_readers.push_back(std::move(reader));
+    }
+    if (rows > std::numeric_limits<int>::max()) {
+      stop("Too many rows selected: %f", static_cast<double>(rows));
+    }
+    m_rows = rows;
+
+    if (m_verbose == 1) {
+      int groups = 0;
+      int groups_skipped = 0;
+      for (auto &reader : m_readers) {
+        groups += reader->row_groups();
+        groups_skipped += reader->groups_skipped();
+      }
+      RParquet_Reader& first = *m_readers.front();
+      Rcout << "\n";
+      Rcout << "FILES:" << m_readers.size() <<"\n";
+      Rcout << "SELECTED ROWS:" << m_rows <<"\n";
+      Rcout << "SELECTED COLUMNS:\n";
+      for (auto &e : first.col_idx_set()) {
+        Rcout << "[id:"<< e << ", name:" << first.col_name(e-1) <<", type:" << first.col_type(e-1) << "]" <<"\n";
+      }
+      Rcout << "ROW GROUPS:" << groups <<"\n";
+      Rcout << "ROW GROUPS SKIPPED:" << groups_skipped <<"\n";
+    }
+  }
+
+  // The column list of all the selected rows, with the selected rows of each
+  // file in the "file_rows" attribute.
+  SEXP create_df() {
+    RParquet_Reader& first = *m_readers.front();
+    int selected_col_size = first.col_idx_set().size();
+    List col_list(selected_col_size);
+    List col_name(selected_col_size);
+    std::vector<int> fixed_cols;
+    std::vector<int> string_cols;
+    std::vector<bool> factor_cols(selected_col_size, false);
+    std::vector<int> col_indices;
+    int index = 0;
+    for (auto &col_idx : first.col_idx_set()) {
+      col_name[index] = first.col_name(col_idx - 1);
+      col_indices.push_back(col_idx - 1);
+      if (first.is_string_col(col_idx - 1)) {
+        factor_cols[index] = m_as_factor && is_dictionary_col(col_idx - 1);
+        col_list[index] = factor_cols[index] ? IntegerVector(m_rows) : first.alloc_col(col_idx - 1, m_rows);
+        string_cols.push_back(index);
+      } else {
+        col_list[index] = first.alloc_col(col_idx - 1, m_rows);
+        fixed_cols.push_back(index);
+      }
+      index++;
+    }
+    // String columns share their CHARSXPs and levels across the files.
+    std::vector<CharSXP_Cache> caches;
+    std::vector<Factor_Levels> levels(selected_col_size);
+    for (auto i = 0; i < selected_col_size; ++i) {
+      bool cached = !factor_cols[i] && first.is_string_col(col_indices[i]) && is_dictionary_col(col_indices[i]);
+      caches.emplace_back(cached ? m_max_cached_strings : 0,
+                          first.col_type(col_indices[i]) == arrow::Type::type::STRING ? CE_UTF8 : CE_NATIVE);
+    }
+
+    for (size_t wave_begin = 0; wave_begin < m_readers.size(); wave_begin += m_max_open_files) {
+      size_t wave_end = std::min(m_readers.size(), wave_begin + m_max_open_files);
+      for (auto f = wave_begin; f < wave_end; ++f) {
+        m_readers[f]->open_file();
+        if (m_readers[f]->prefetch()) {
+          m_readers[f]->prefetch_chunks(0, m_readers[f]->row_groups());
+        }
+      }
+      std::vector<std::function<void()>> tasks;
+      for (auto f = wave_begin; f < wave_end; ++f) {
+        for (auto &i : fixed_cols) {
+          m_readers[f]->add_col_tasks(col_indices[i], 0, m_readers[f]->row_groups(), col_list[i],
+                                      m_file_offset[f], tasks);
+        }
+      }
+      run_tasks(tasks, m_threads);
+      // The string chunks of the wave are decoded ahead of their conversion
+      // within the depth and memory budget of the pipeline, or without one a
+      // file at a time.
+      for (auto &i : string_cols) {
+        std::unique_ptr<Chunk_Pipeline> pipeline;
+        if (first.pipeline_depth() > 0) {
+          std::vector<std::function<std::shared_ptr<arrow::Array>()>> chunk_tasks;
+          std::vector<int64_t> costs;
+          for (auto f = wave_begin; f < wave_end; ++f) {
+            m_readers[f]->add_pipeline_tasks({col_indices[i]}, 0, m_readers[f]->row_groups(), chunk_tasks, costs);
+          }
+          pipeline.reset(new Chunk_Pipeline(std::move(chunk_tasks), std::move(costs), m_threads,
+                                            first.pipeline_depth(), first.pipeline_memory()));
+        }
+        for (auto f = wave_begin; f < wave_end; ++f) {
+          std::vector<std::shared_ptr<arrow::Array>> arrays;
+          Chunk_Source source = nullptr;
+          if (pipeline) {
+            source = [&pipeline](int) { return pipeline->take(); };
+          } else {
+            arrays = m_readers[f]->read_chunks(col_indices[i], 0, m_readers[f]->row_groups());
+            source = RParquet_Reader::chunk_source(arrays);
+          }
+          if (factor_cols[i]) {
+            m_readers[f]->fill_factor_codes(col_indices[i], source, INTEGER(col_list[i]),
+                                            m_file_offset[f], levels[i], 0, m_readers[f]->row_groups());
+          } else {
+            m_readers[f]->fill_string_col(col_indices[i], source, col_list[i],
+                                          m_file_offset[f], caches[i], 0, m_readers[f]->row_groups());
+          }
+        }
+      }
+      for (auto f = wave_begin; f < wave_end; ++f) {
+        m_readers[f]->close_file();
+      }
+    }
+
+    for (auto &i : string_cols) {
+      if (factor_cols[i]) {
+        IntegerVector ivec = col_list[i];
+        RParquet_Reader::set_factor_levels(ivec, levels[i],
+            first.col_type(col_indices[i]) == arrow::Type::type::STRING ? CE_UTF8 : CE_NATIVE);
+      }
+    }
+    IntegerVector file_rows(m_readers.size());
+    for (size_t f = 0; f < m_readers.size(); ++f) {
+      file_rows[f] = m_readers[f]->selected_rows();
+    }
+    col_list.attr("names") = col_name;
+    col_list.attr("row.names") = IntegerVector::create(NA_INTEGER, -m_rows);
+    col_list.attr("class") = "data.frame";
+    col_list.attr("file_rows") = file_rows;
+    return col_list;
+  }
+
+private:
+  static bool same_columns(const RParquet_Reader& a, const RParquet_Reader& b) {
+    if (a.col_idx_set() != b.col_idx_set()) {
+      return false;
+    }
+    for (auto &col_idx : a.col_idx_set()) {
+      if (a.col_name(col_idx - 1) != b.col_name(col_idx - 1) || a.col_type(col_idx - 1) != b.col_type(col_idx - 1)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // A string column is read through the CHARSXP cache, or as a factor, when
+  // it is dictionary encoded in any of the files.
+  bool is_dictionary_col(int col_idx) {
+    for (auto &reader : m_readers) {
+      if (reader->is_dictionary_col(col_idx)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static const size_t m_max_open_files = 64;
+  static const size_t m_max_cached_strings = 1 << 20;
+  static const int m_read_row_size = 100000;
+  std::vector<std::string>                      m_filenames;
+  IntegerVector                                 m_selected_col;
+  List                                          m_where;
+  bool                                          m_as_factor;
+  int                                           m_threads;
+  List                                          m_io_options;
+  int                                           m_verbose;
+  int                                           m_rows;
+  std::vector<int64_t>                          m_file_offset;
+  std::vector<std::unique_ptr<RParquet_Reader>> m_readers;
+};
+
+// Statistics of the column chunks of many files, one row per file, row group
+// and column. The footers come from the metadata cache when current and are
+// read on up to "threads" worker threads, the data frame is made on the main
+// thread.
+class RParquet_Stats {
+public:
+  // Statistics of one column chunk. The min and max are kept in the type of
+  // the R vector of the column: int64_t for logical, integer, integer64 and
+  // nanotime (in nanoseconds), double and string.
+  struct Chunk_Stats {
+    int         group_idx;
+    int         col_idx;
+    int64_t     group_rows;
+    int64_t     num_values;
+    int64_t     null_count; // -1 without statistics
+    int64_t     compressed_size;
+    int64_t     uncompressed_size;
+    bool        has_min_max;
+    int64_t     int_min;
+    int64_t     int_max;
+    double      dbl_min;
+    double      dbl_max;
+    std::string str_min;
+    std::string str_max;
+    std::string encodings;
+    std::string codec;
+  };
+
+  RParquet_Stats(CharacterVector filenames, int threads) :
+    m_filenames(as<std::vector<std::string>>(filenames)),
+    m_threads(threads),
+    m_files(m_filenames.size()) {
+  }
+
+  void init() {
+    std::vector<std::function<void()>> tasks;
+    for (size_t f = 0; f < m_filenames.size(); ++f) {
+      tasks.push_back([this, f]() { read_file(f); });
+    }
+    run_tasks(tasks, m_threads);
+  }
+
+  DataFrame create_df() {
+    size_t rows = 0;
+    for (auto &file : m_files) {
+      rows += file.chunks.size();
+    }
+    CharacterVector file_name(rows);
+    IntegerVector row_group(rows);
+    CharacterVector column(rows);
+    CharacterVector type(rows);
+    NumericVector group_rows(rows);
+    NumericVector num_values(rows);
+    NumericVector null_count(rows);
+    NumericVector compressed_size(rows);
+    NumericVector uncompressed_size(rows);
+    List min(rows);
+    List max(rows);
+    CharacterVector encodings(rows);
+    CharacterVector codec(rows);
+    size_t i = 0;
+    for (size_t f = 0; f < m_files.size(); ++f) {
+      const File_Stats& file = m_files[f];
+      for (auto &chunk : file.chunks) {
+        arrow::Type::type col_type = file.col_types[chunk.col_idx];
+        file_name[i] = m_filenames[f];
+        row_group[i] = chunk.group_idx + 1;
+        column[i] = Rf_mkCharCE(file.col_names[chunk.col_idx].c_str(), CE_UTF8);
+        type[i] = file.col_types_names[chunk.col_idx];
+        group_rows[i] = chunk.group_rows;
+        num_values[i] = chunk.num_values;
+        null_count[i] = chunk.null_count < 0 ? NA_REAL : chunk.null_count;
+        compressed_size[i] = chunk.compressed_size;
+        uncompressed_size[i] = chunk.uncompressed_size;
+        min[i] = stat_value(col_type, chunk.has_min_max, chunk.int_min, chunk.dbl_min, chunk.str_min);
+        max[i] = stat_value(col_type, chunk.has_min_max, chunk.int_max, chunk.dbl_max, chunk.str_max);
+        encodings[i] = chunk.encodings;
+        codec[i] = chunk.codec;
+        ++i;
+      }
+    }
+    List col_list = List::create(file_name, row_group, column, type, group_rows, num_values, null_count,
+                                 compressed_size, uncompressed_size, min, max, encodings, codec);
+    col_list.attr("names") = CharacterVector::create("file", "row_group", "column", "type", "rows", "num_values",
+                                                     "null_count", "compressed_size", "uncompressed_size",
+                                                     "min", "max", "encodings", "codec");
+    col_list.attr("row.names") = IntegerVector::create(NA_INTEGER, -static_cast<int>(rows));
+    col_list.attr("class") = "data.frame";
+    return col_list;
+  }
+
+  // Decodes the min and max of a chunk into the type of its R vector, false
+  // for the columns the reader does not read.
+  static bool read_min_max(const parquet::RowGroupStatistics& stats, parquet::Type::type physical_type,
+                           arrow::Type::type col_type, int64_t scale, Chunk_Stats& chunk) {
+    switch (col_type) {
+      case arrow::Type::type::BOOL: {
+        auto& typed_stats = static_cast<const parquet::BoolStatistics&>(stats);
+        chunk.int_min = typed_stats.min();
+        chunk.int_max = typed_stats.max();
+        return true;
+      }
+      case arrow::Type::type::INT32: {
+        auto& typed_stats = static_cast<const parquet::Int32Statistics&>(stats);
+        chunk.int_min = typed_stats.min();
+        chunk.int_max = typed_stats.max();
+        return true;
+      }
+      case arrow::Type::type::INT64:
+      case arrow::Type::type::TIMESTAMP: {
+        // INT96 timestamps have no ordered statistics.
+        if (physical_type != parquet::Type::INT64) {
+          return false;
+        }
+        auto& typed_stats = static_cast<const parquet::Int64Statistics&>(stats);
+        chunk.int_min = typed_stats.min() * scale;
+        chunk.int_max = typed_stats.max() * scale;
+        return true;
+      }
+      case arrow::Type::type::DOUBLE: {
+        auto& typed_stats = static_cast<const parquet::DoubleStatistics&>(stats);
+        chunk.dbl_min = typed_stats.min();
+        chunk.dbl_max = typed_stats.max();
+        return true;
+      }
+      case arrow::Type::type::BINARY:
+      case arrow::Type::type::STRING: {
+        auto& typed_stats = static_cast<const parquet::ByteArrayStatistics&>(stats);
+        chunk.str_min.assign(reinterpret_cast<const char*>(typed_stats.min().ptr), typed_stats.min().len);
+        chunk.str_max.assign(reinterpret_cast<const char*>(typed_stats.max().ptr), typed_stats.max().len);
+        return true;
+      }
+      default:
+        return false;
+    }
+  }
+
+private:
+  struct File_Stats {
+    std::vector<std::string>        col_names;
+    std::vector<arrow::Type::type>  col_types;
+    std::vector<std::string>        col_types_names;
+    std::vector<Chunk_Stats>        chunks;
+  };
+
+  // Runs on a worker thread, must not touch the R API.
+  void read_file(size_t f) {
+    std::shared_ptr<Cached_Metadata> cached = cached_metadata(m_filenames[f]);
+    const std::shared_ptr<parquet::FileMetaData>& metadata = cached->metadata();
+    std::shared_ptr<arrow::Schema> schema = cached->schema();
+    if (schema == nullptr) {
+      PARQUET_THROW_NOT_OK(parquet::arrow::FromParquetSchema(metadata->schema(), metadata->key_value_metadata(),
+                                                             &schema));
+      cached->set_schema(schema);
+    }
+    File_Stats& file = m_files[f];
+    std::vector<int64_t> scale;
+    int num_columns = schema->num_fields();
+    for (auto &field : schema->fields()) {
+      file.col_names.push_back(field->name());
+      file.col_types.push_back(field->type()->id());
+      file.col_types_names.push_back(field->type()->name());
+      scale.push_back(field->type()->id() == arrow::Type::type::TIMESTAMP ?
+          ticks_per_unit(std::static_pointer_cast<arrow::TimestampType>(field->type())->unit()) : 1);
+    }
+    for (int group_idx = 0; group_idx < metadata->num_row_groups(); ++group_idx) {
+      auto group_metadata = metadata->RowGroup(group_idx);
+      for (int col_idx = 0; col_idx < num_columns; ++col_idx) {
+        auto column_chunk = group_metadata->ColumnChunk(col_idx);
+        Chunk_Stats chunk = Chunk_Stats();
+        chunk.group_idx = group_idx;
+        chunk.col_idx = col_idx;
+        chunk.group_rows = group_metadata->num_rows();
+        chunk.num_values = column_chunk->num_values();
+        chunk.compressed_size = column_chunk->total_compressed_size();
+        chunk.uncompressed_size = column_chunk->total_uncompressed_size();
+        for (auto &encoding : column_chunk->encodings()) {
+          chunk.encodings += (chunk.encodings.empty() ? "" : ",") + EncodingToString(encoding);
+        }
+        chunk.codec = CompressionToString(column_chunk->compression());
+        std::shared_ptr<parquet::RowGroupStatistics> stats = cached->statistics(group_idx, col_idx);
+        chunk.null_count = stats == nullptr ? -1 : stats->null_count();
+        if (stats != nullptr && stats->HasMinMax()) {
+          chunk.has_min_max = read_min_max(*stats, metadata->schema()->Column(col_idx)->physical_type(),
+                                           file.col_types[col_idx], scale[col_idx], chunk);
+        }
+        file.chunks.push_back(chunk);
+      }
+    }
+  }
+
+  // A length one vector of the R type of the column, NA when the chunk has
+  // no min and max, NULL for the columns the reader does not read.
+  static SEXP stat_value(arrow::Type::type col_type, bool has_value, int64_t int_value, double dbl_value,
+                         const std::string& str_value) {
+    switch (col_type) {
+      case arrow::Type::type::BOOL:
+        return LogicalVector::create(has_value ? static_cast<int>(int_value) : NA_LOGICAL);
+      case arrow::Type::type::INT32:
+        return IntegerVector::create(has_value ? static_cast<int>(int_value) : NA_INTEGER);
+      case arrow::Type::type::INT64:
+      case arrow::Type::type::TIMESTAMP: {
+        NumericVector value(1);
+        *reinterpret_cast<int64_t*>(REAL(value)) = has_value ? int_value : NA_INTEGER64;
+        RParquet_Reader::set_type_class(col_type, value);
+        return value;
+      }
+      case arrow::Type::type::DOUBLE:
+        return NumericVector::create(has_value ? dbl_value : NA_REAL);
+      case arrow::Type::type::BINARY:
+      case arrow::Type::type::STRING: {
+        CharacterVector value(1);
+        if (has_value) {
+          value[0] = Rf_mkCharLenCE(str_value.data(), r_string_len(str_value.data(), str_value.size()),
+                                    col_type == arrow::Type::type::STRING ? CE_UTF8 : CE_NATIVE);
+        } else {
+          value[0] = NA_STRING;
+        }
+        return value;
+      }
+      default:
+        return R_NilValue;
+    }
+  }
+
+  std::vector<std::string> m_filenames;
+  int                      m_threads;
+  std::vector<File_Stats>  m_files;
+};
+
+// Running aggregates of the values of a column in one group. Logical, integer,
+// integer64 and nanotime (in nanoseconds) values are kept as int64, and summed
+// into int_sum, sum_overflow set once it overflows. NaN counts as NA, as
+// is.na() does, and strings are compared by their bytes.
+struct Aggregate_State {
+  int64_t     count = 0;
+  int64_t     null_count = 0;
+  double      sum = 0;
+  int64_t     int_sum = 0;
+  bool        sum_overflow = false;
+  bool        has_min_max = false;
+  int64_t     int_min = 0;
+  int64_t     int_max = 0;
+  double      dbl_min = 0;
+  double      dbl_max = 0;
+  std::string str_min;
+  std::string str_max;
+
+  void add_null() {
+    null_count++;
+  }
+
+  void add(int64_t value) {
+    count++;
+    add_sum(value);
+    add_min_max(value);
+  }
+
+  void add(double value) {
+    if (std::isnan(value)) {
+      null_count++;
+      return;
+    }
+    count++;
+    add_sum(value);
+    add_min_max(value);
+  }
+
+  void add_sum(int64_t value) {
+    sum_overflow |= __builtin_add_overflow(int_sum, value, &int_sum);
+  }
+
+  void add_sum(double value) {
+    sum += value;
+  }
+
+  void add(const char* data, int32_t len) {
+    count++;
+    if (!has_min_max || str_min.compare(0, str_min.size(), data, len) > 0) {
+      str_min.assign(data, len);
+    }
+    if (!has_min_max || str_max.compare(0, str_max.size(), data, len) < 0) {
+      str_max.assign(data, len);
+    }
+    has_min_max = true;
+  }
+
+  // Adds count values without NA of the given min and max, their sum is
+  // added with add_sum.
+  template <typename ValueType>
+  void add_run(int64_t values, ValueType min, ValueType max) {
+    if (values == 0) {
+      return;
+    }
+    count += values;
+    add_min_max(min);
+    add_min_max(max);
+  }
+
+  // Only the min and max of one kind are set, those of the other kinds stay
+  // equal in both states.
+  void merge(const Aggregate_State& other) {
+    count += other.count;
+    null_count += other.null_count;
+    sum += other.sum;
+    add_sum(other.int_sum);
+    sum_overflow |= other.sum_overflow;
+    if (!other.has_min_max) {
+      return;
+    }
+    if (!has_min_max) {
+      has_min_max = true;
+      int_min = other.int_min;
+      int_max = other.int_max;
+      dbl_min = other.dbl_min;
+      dbl_max = other.dbl_max;
+      str_min = other.str_min;
+      str_max = other.str_max;
+      return;
+    }
+    int_min = std::min(int_min, other.int_min);
+    int_max = std::max(int_max, other.int_max);
+    dbl_min = std::min(dbl_min, other.dbl_min);
+    dbl_max = std::max(dbl_max, other.dbl_max);
+    if (other.str_min < str_min) {
+      str_min = other.str_min;
+    }
+    if (other.str_max > str_max) {
+      str_max = other.str_max;
+    }
+  }
+
+private:
+  void add_min_max(int64_t value) {
+    int_min = has_min_max ? std::min(int_min, value) : value;
+    int_max = has_min_max ? std::max(int_max, value) : value;
+    has_min_max = true;
+  }
+
+  void add_min_max(double value) {
+    dbl_min = has_min_max ? std::min(dbl_min, value) : value;
+    dbl_max = has_min_max ? std::max(dbl_max, value) : value;
+    has_min_max = true;
+  }
+};
+
+// A value of the "by" column: int64 for logical, integer, integer64 and
+// nanotime (in nanoseconds) columns, the bytes of string columns.
+struct Group_Key {
+  bool        na;
+  int64_t     int_value;
+  std::string str_value;
+};
+
+// The distinct keys of the "by" column, numbered from 0 in the order first
+// seen, NA being one of them. Bounded by m_max_groups, as the states of all
+// the groups are kept in memory.
+class Group_Keys {
+public:
+  int slot(int64_t value) {
+    auto it = m_int_slots.find(value);
+    if (it != m_int_slots.end()) {
+      return it->second;
+    }
+    int slot = new_slot(Group_Key{false, value, std::string()});
+    m_int_slots.emplace(value, slot);
+    return slot;
+  }
+
+  int slot(const char* data, int32_t len) {
+    size_t code = m_levels.code(data, len);
+    if (code > m_level_slots.size()) {
+      m_level_slots.push_back(new_slot(Group_Key{false, 0, m_levels.levels()[code - 1]}));
+    }
+    return m_level_slots[code - 1];
+  }
+
+  int na_slot() {
+    if (m_na_slot < 0) {
+      m_na_slot = new_slot(Group_Key{true, 0, std::string()});
+    }
+    return m_na_slot;
+  }
+
+  int slot(const Group_Key& key, bool is_string) {
+    if (key.na) {
+      return na_slot();
+    }
+    return is_string ? slot(key.str_value.data(), key.str_value.size()) : slot(key.int_value);
+  }
+
+  const std::vector<Group_Key>& keys() const {
+    return m_keys;
+  }
+
+private:
+  int new_slot(Group_Key key) {
+    if (m_keys.size() >= m_max_groups) {
+      throw std::runtime_error("Too many distinct values in the by column");
+    }
+    m_keys.push_back(std::move(key));
+    return m_keys.size() - 1;
+  }
+
+  static const size_t m_max_groups = 1 << 20;
+  std::unordered_map<int64_t, int> m_int_slots;
+  Factor_Levels                    m_levels;
+  std::vector<int>                 m_level_slots;
+  int                              m_na_slot = -1;
+  std::vector<Group_Key>           m_keys;
+};
+
+// Reduces columns of a file to count, null_count, sum, mean, min and max,
+// by the groups of an optional "by" column, without making R vectors of the
+// values. The reader plans the read (where conditions, skipped row groups),
+// then each row group is reduced by a worker into its own states, merged into
+// the totals once done, so only the chunks being reduced are held in memory.
+// Without by, the row groups with all their rows selected take count,
+// null_count, min and max from the statistics of the chunks when no sum or
+// mean is wanted, except for double columns whose statistics may hold NaN.
+class RParquet_Aggregate {
+public:
+  RParquet_Aggregate(std::string filename,
+                     CharacterVector columns,
+                     CharacterVector funs,
+                     List where,
+                     CharacterVector by,
+                     int threads,
+                     List io_options,
+                     int verbose
+                     ) :
+    m_reader(filename, IntegerVector::create(-1), LogicalVector::create(TRUE), where, NumericVector(),
+             NumericVector(), false, m_read_row_size, threads, io_options, false, verbose),
+    m_col_names(as<std::vector<std::string>>(columns)),
+    m_funs(as<std::vector<std::string>>(funs)),
+    m_by_name(as<std::vector<std::string>>(by)),
+    m_threads(threads),
+    m_verbose(verbose),
+    m_by_col(-1),
+    m_stats_groups(0) {
+  }
+
+  void init() {
+    m_reader.init();
+    if (m_col_names.empty()) {
+      stop("No column to aggregate.");
+    }
+    for (auto &name : m_col_names) {
+      m_cols.push_back(find_col(name));
+    }
+    for (auto &col_idx : m_cols) {
+      check_col_type(col_idx);
+    }
+    const std::vector<std::string> known_funs = {"count", "null_count", "sum", "mean", "min", "max"};
+    for (auto &fun : m_funs) {
+      if (std::find(known_funs.begin(), known_funs.end(), fun) == known_funs.end()) {
+        stop("Unknown aggregate function: %s", fun);
+      }
+      for (auto &col_idx : m_cols) {
+        arrow::Type::type type = m_reader.col_type(col_idx);
+        if ((fun == "sum" || fun == "mean") && (m_reader.is_string_col(col_idx) || type == arrow::Type::type::TIMESTAMP)) {
+          stop("Function %s is not supported on column %s", fun, m_reader.col_name(col_idx));
+        }
+      }
+    }
+    if (m_by_name.size() > 1) {
+      stop("Only one by column is supported.");
+    }
+    if (m_by_name.size() == 1) {
+      m_by_col = find_col(m_by_name[0]);
+      if (m_reader.col_type(m_by_col) == arrow::Type::type::DOUBLE) {
+        stop("By column %s should not be double", m_by_name[0]);
+      }
+      check_col_type(m_by_col);
+    }
+    m_from_stats = !has_fun("sum") && !has_fun("mean");
+    m_need_min_max = has_fun("min") || has_fun("max");
+    // Without by there is a single group, present even when no row is
+    // selected.
+    if (m_by_col < 0) {
+      m_total.rows.push_back(0);
+      m_total.states.resize(m_cols.size());
+    }
+  }
+
+  DataFrame create_df() {
+    std::vector<std::function<void()>> tasks;
+    for (auto group_idx = 0; group_idx < m_reader.row_groups(); ++group_idx) {
+      if (!m_reader.skip_group(group_idx)) {
+        tasks.push_back([this, group_idx]() { reduce_group(group_idx); });
+      }
+    }
+    run_tasks(tasks, m_threads);
+    if (m_verbose == 1) {
+      Rcout << "ROW GROUPS REDUCED:" << tasks.size() << "\n";
+      Rcout << "ROW GROUPS FROM STATISTICS:" << m_stats_groups << "\n";
+    }
+
+    std::vector<int> order(m_total.rows.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      order[i] = i;
+    }
+    if (m_by_col >= 0) {
+      bool is_string = m_reader.is_string_col(m_by_col);
+      const std::vector<Group_Key>& keys = m_total.keys.keys();
+      std::sort(order.begin(), order.end(), [&](int a, int b) {
+        if (keys[a].na || keys[b].na) {
+          return !keys[a].na && keys[b].na;
+        }
+        return is_string ? keys[a].str_value < keys[b].str_value : keys[a].int_value < keys[b].int_value;
+      });
+    }
+
+    List col_list;
+    std::vector<std::string> col_names;
+    if (m_by_col >= 0) {
+      col_list.push_back(key_col(order));
+      col_names.push_back(m_reader.col_name(m_by_col));
+    }
+    NumericVector rows(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      rows[i] = m_total.rows[order[i]];
+    }
+    col_list.push_back(rows);
+    col_names.push_back("rows");
+    for (size_t c = 0; c < m_cols.size(); ++c) {
+      for (auto &fun : m_funs) {
+        col_list.push_back(fun_col(c, fun, order));
+        col_names.push_back(m_reader.col_name(m_cols[c]) + "_" + fun);
+      }
+    }
+    col_list.attr("names") = wrap(col_names);
+    col_list.attr("row.names") = IntegerVector::create(NA_INTEGER, -static_cast<int>(order.size()));
+    col_list.attr("class") = "data.frame";
+    return col_list;
+  }
+
+private:
+  // The groups and the states of the columns by group, m_cols.size() states
+  // per group.
+  struct Partial {
+    Group_Keys                   keys;
+    std::vector<int64_t>         rows;
+    std::vector<Aggregate_State> states;
+  };
+
+  bool has_fun(const char* fun) {
+    return std::find(m_funs.begin(), m_funs.end(), fun) != m_funs.end();
+  }
+
+  int find_col(const std::string& name) {
+    for (auto &col_idx : m_reader.col_idx_set()) {
+      if (m_reader.col_name(col_idx - 1) == name) {
+        return col_idx - 1;
+      }
+    }
+    stop("Unknown column: %s", name);
+  }
+
+  void check_col_type(int col_idx) {
+    switch (m_reader.col_type(col_idx)) {
+      case arrow::Type::type::BOOL:
+      case arrow::Type::type::INT32:
+      case arrow::Type::type::INT64:
+      case arrow::Type::type::TIMESTAMP:
+      case arrow::Type::type::DOUBLE:
+      case arrow::Type::type::BINARY:
+      case arrow::Type::type::STRING:
+        return;
+      default:
+        stop("Unsupported column type in aggregate, name:%s", m_reader.col_name(col_idx));
+    }
+  }
+
+  // Runs on a worker thread, must not touch the R API.
+  void reduce_group(int group_idx) {
+    Partial partial;
+    std::vector<int> slots;
+    if (m_by_col >= 0) {
+      group_slots(group_idx, partial, slots);
+    } else {
+      partial.rows.push_back(m_reader.selection(group_idx).size(m_reader.group_rows(group_idx)));
+    }
+    partial.states.resize(partial.rows.size() * m_cols.size());
+    bool from_stats = false;
+    for (size_t c = 0; c < m_cols.size(); ++c) {
+      if (m_by_col < 0 && reduce_stats(group_idx, m_cols[c], partial.states[c])) {
+        from_stats = true;
+        continue;
+      }
+      std::shared_ptr<arrow::Array> array = m_reader.read_rows(group_idx, m_cols[c]);
+      reduce_chunk(group_idx, m_cols[c], *array, slots, partial.states.data() + c);
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    bool is_string = m_by_col >= 0 && m_reader.is_string_col(m_by_col);
+    for (size_t s = 0; s < partial.rows.size(); ++s) {
+      size_t total_slot = 0;
+      if (m_by_col >= 0) {
+        total_slot = m_total.keys.slot(partial.keys.keys()[s], is_string);
+        if (total_slot == m_total.rows.size()) {
+          m_total.rows.push_back(0);
+          m_total.states.resize(m_total.rows.size() * m_cols.size());
+        }
+      }
+      m_total.rows[total_slot] += partial.rows[s];
+      for (size_t c = 0; c < m_cols.size(); ++c) {
+        m_total.states[total_slot * m_cols.size() + c].merge(partial.states[s * m_cols.size() + c]);
+      }
+    }
+    m_stats_groups += from_stats;
+  }
+
+  // The group of each selected row of the row group, and the rows by group.
+  void group_slots(int group_idx, Partial& partial, std::vector<int>& slots) {
+    std::shared_ptr<arrow::Array> array = m_reader.read_rows(group_idx, m_by_col);
+    slots.resize(m_reader.selection(group_idx).size(m_reader.group_rows(group_idx)));
+    Group_Keys& keys = partial.keys;
+    switch (m_reader.col_type(m_by_col)) {
+      case arrow::Type::type::INT32:
+        key_slots<arrow::Int32Array>(group_idx, *array, keys, slots,
+            [](const arrow::Int32Array& ary, int64_t i) { return static_cast<int64_t>(ary.Value(i)); });
+        break;
+      case arrow::Type::type::INT64:
+        key_slots<arrow::Int64Array>(group_idx, *array, keys, slots,
+            [](const arrow::Int64Array& ary, int64_t i) { return ary.Value(i); });
+        break;
+      case arrow::Type::type::TIMESTAMP: {
+        int64_t scale = m_reader.col_scale(m_by_col);
+        key_slots<arrow::TimestampArray>(group_idx, *array, keys, slots,
+            [scale](const arrow::TimestampArray& ary, int64_t i) { return ary.Value(i) * scale; });
+        break;
+      }
+      case arrow::Type::type::BOOL:
+        key_slots<arrow::BooleanArray>(group_idx, *array, keys, slots,
+            [](const arrow::BooleanArray& ary, int64_t i) { return static_cast<int64_t>(ary.Value(i)); });
+        break;
+      default: {
+        const arrow::BinaryArray& arrow_array = static_cast<const arrow::BinaryArray&>(*array);
+        for_each_row(group_idx, *array, [&](int64_t i, int64_t k) {
+          if (arrow_array.IsNull(i)) {
+            slots[k] = keys.na_slot();
+          } else {
+            int32_t len;
+            const uint8_t* data = arrow_array.GetValue(i, &len);
+            slots[k] = keys.slot(reinterpret_cast<const char*>(data), len);
+          }
+        });
+        break;
+      }
+    }
+    partial.rows.assign(keys.keys().size(), 0);
+    for (auto &slot : slots) {
+      partial.rows[slot]++;
+    }
+  }
+
+  template <typename ArrowArrayType, typename FuncType>
+  void key_slots(int group_idx, const arrow::Array& array, Group_Keys& keys, std::vector<int>& slots,
+                 FuncType get_value) {
+    const ArrowArrayType& arrow_array = static_cast<const ArrowArrayType&>(array);
+    for_each_row(group_idx, array, [&](int64_t i, int64_t k) {
+      slots[k] = arrow_array.IsNull(i) ? keys.na_slot() : keys.slot(get_value(arrow_array, i));
+    });
+  }
+
+  // Takes count, null_count, min and max of a chunk with all its rows
+  // selected from its statistics, false when they can not answer.
+  bool reduce_stats(int group_idx, int col_idx, Aggregate_State& state) {
+    if (!m_from_stats || !m_reader.selection(group_idx).all ||
+        m_reader.col_type(col_idx) == arrow::Type::type::DOUBLE) {
+      return false;
+    }
+    std::shared_ptr<parquet::RowGroupStatistics> stats = m_reader.statistics(group_idx, col_idx);
+    if (stats == nullptr) {
+      return false;
+    }
+    int64_t rows = m_reader.group_rows(group_idx);
+    int64_t values = rows - stats->null_count();
+    RParquet_Stats::Chunk_Stats chunk = RParquet_Stats::Chunk_Stats();
+    bool min_max = values > 0 && m_need_min_max;
+    if (min_max && !(stats->HasMinMax() &&
+        RParquet_Stats::read_min_max(*stats, m_reader.physical_type(col_idx), m_reader.col_type(col_idx),
+                                     m_reader.col_scale(col_idx), chunk))) {
+      return false;
+    }
+    state.null_count += stats->null_count();
+    if (!min_max) {
+      state.count += values;
+    } else if (m_reader.is_string_col(col_idx)) {
+      Aggregate_State run;
+      run.add(chunk.str_min.data(), chunk.str_min.size());
+      run.add(chunk.str_max.data(), chunk.str_max.size());
+      run.count = values;
+      state.merge(run);
+    } else {
+      state.add_run<int64_t>(values, chunk.int_min, chunk.int_max);
+    }
+    return true;
+  }
+
+  // Adds the selected rows of a chunk to the states of their groups, states
+  // being those of the column in the first group.
+  void reduce_chunk(int group_idx, int col_idx, const arrow::Array& array, const std::vector<int>& slots,
+                    Aggregate_State* states) {
+    size_t stride = m_cols.size();
+    auto state = [&](int64_t k) -> Aggregate_State& { return states[slots.empty() ? 0 : slots[k] * stride]; };
+    bool single = slots.empty() && m_reader.dense_rows(group_idx, array) && array.null_count() == 0;
+    switch (m_reader.col_type(col_idx)) {
+      case arrow::Type::type::INT32:
+        if (single) {
+          reduce_run(static_cast<const arrow::Int32Array&>(array).raw_values(), array.length(), *states);
+        } else {
+          reduce_values<arrow::Int32Array>(group_idx, array, state,
+              [](const arrow::Int32Array& ary, int64_t i) { return static_cast<int64_t>(ary.Value(i)); });
+        }
+        break;
+      case arrow::Type::type::INT64:
+        if (single) {
+          reduce_run(static_cast<const arrow::Int64Array&>(array).raw_values(), array.length(), *states);
+        } else {
+          reduce_values<arrow::Int64Array>(group_idx, array, state,
+              [](const arrow::Int64Array& ary, int64_t i) { return ary.Value(i); });
+        }
+        break;
+      case arrow::Type::type::DOUBLE:
+        if (single) {
+          reduce_run(static_cast<const arrow::DoubleArray&>(array).raw_values(), array.length(), *states);
+        } else {
+          reduce_values<arrow::DoubleArray>(group_idx, array, state,
+              [](const arrow::DoubleArray& ary, int64_t i) { return ary.Value(i); });
+        }
+        break;
+      case arrow::Type::type::TIMESTAMP: {
+        int64_t scale = m_reader.col_scale(col_idx);
+        reduce_values<arrow::TimestampArray>(group_idx, array, state,
+            [scale](const arrow::TimestampArray& ary, int64_t i) { return ary.Value(i) * scale; });
+        break;
+      }
+      case arrow::Type::type::BOOL:
+        reduce_values<arrow::BooleanArray>(group_idx, array, state,
+            [](const arrow::BooleanArray& ary, int64_t i) { return static_cast<int64_t>(ary.Value(i)); });
+        break;
+      default: {
+        const arrow::BinaryArray& arrow_array = static_cast<const arrow::BinaryArray&>(array);
+        for_each_row(group_idx, array, [&](int64_t i, int64_t k) {
+          if (arrow_array.IsNull(i)) {
+            state(k).add_null();
+          } else {
+            int32_t len;
+            const uint8_t* data = arrow_array.GetValue(i, &len);
+            state(k).add(reinterpret_cast<const char*>(data), r_string_len(reinterpret_cast<const char*>(data), len));
+          }
+        });
+        break;
+      }
+    }
+  }
+
+  template <typename ArrowArrayType, typename StateFunc, typename FuncType>
+  void reduce_values(int group_idx, const arrow::Array& array, StateFunc state, FuncType get_value) {
+    const ArrowArrayType& arrow_array = static_cast<const ArrowArrayType&>(array);
+    for_each_row(group_idx, array, [&](int64_t i, int64_t k) {
+      if (arrow_array.IsNull(i)) {
+        state(k).add_null();
+      } else {
+        state(k).add(get_value(arrow_array, i));
+      }
+    });
+  }
+
+  // Reduces a run of int32 without nulls in one pass. A chunk has fewer than
+  // 2^31 rows, so their sum can not overflow an int64 and the loop has no
+  // branch the compiler must keep.
+  static void reduce_run(const int32_t* values, int64_t length, Aggregate_State& state) {
+    if (length == 0) {
+      return;
+    }
+    int64_t sum = 0;
+    int32_t min = values[0];
+    int32_t max = values[0];
+    for (int64_t i = 0; i < length; ++i) {
+      sum += values[i];
+      min = std::min(min, values[i]);
+      max = std::max(max, values[i]);
+    }
+    state.add_run<int64_t>(length, min, max);
+    state.add_sum(sum);
+  }
+
+  // int64 values are summed with an overflow check per value.
+  static void reduce_run(const int64_t* values, int64_t length, Aggregate_State& state) {
+    if (length == 0) {
+      return;
+    }
+    int64_t sum = 0;
+    bool overflow = false;
+    int64_t min = values[0];
+    int64_t max = values[0];
+    for (int64_t i = 0; i < length; ++i) {
+      overflow |= __builtin_add_overflow(sum, values[i], &sum);
+      min = std::min(min, values[i]);
+      max = std::max(max, values[i]);
+    }
+    state.add_run<int64_t>(length, min, max);
+    state.add_sum(sum);
+    state.sum_overflow |= overflow;
+  }
+
+  // Doubles are summed first, a NaN sum (from NaN values or infinities of
+  // both signs) falls back to the value by value path.
+  static void reduce_run(const double* values, int64_t length, Aggregate_State& state) {
+    double sum = 0;
+    for (int64_t i = 0; i < length; ++i) {
+      sum += values[i];
+    }
+    if (std::isnan(sum)) {
+      for (int64_t i = 0; i < length; ++i) {
+        state.add(values[i]);
+      }
+      return;
+    }
+    if (length == 0) {
+      return;
+    }
+    double min = values[0];
+    double max = values[0];
+    for (int64_t i = 0; i < length; ++i) {
+      min = std::min(min, values[i]);
+      max = std::max(max, values[i]);
+    }
+    state.add_run<double>(length, min, max);
+    state.add_sum(sum);
+  }
+
+  // Calls fn(i, k) on the k-th selected row of the row group, at index i of
+  // the array.
+  template <typename FuncType>
+  void for_each_row(int group_idx, const arrow::Array& array, FuncType fn) {
+    if (m_reader.dense_rows(group_idx, array)) {
+      for (int64_t i = 0; i < array.length(); ++i) {
+        fn(i, i);
+      }
+    } else {
+      const std::vector<int32_t>& rows = m_reader.selection(group_idx).rows;
+      for (size_t k = 0; k < rows.size(); ++k) {
+        fn(rows[k], k);
+      }
+    }
+  }
+
+  SEXP key_col(const std::vector<int>& order) {
+    const std::vector<Group_Key>& keys = m_total.keys.keys();
+    arrow::Type::type type = m_reader.col_type(m_by_col);
+    R_xlen_t size = order.size();
+    switch (type) {
+      case arrow::Type::type::INT32:
+      case arrow::Type::type::BOOL: {
+        IntegerVector ivec(size);
+        for (R_xlen_t i = 0; i < size; ++i) {
+          const Group_Key& key = keys[order[i]];
+          ivec[i] = key.na ? NA_INTEGER : static_cast<int>(key.int_value);
+        }
+        if (type == arrow::Type::type::BOOL) {
+          return LogicalVector(ivec);
+        }
+        return ivec;
+      }
+      case arrow::Type::type::INT64:
+      case arrow::Type::type::TIMESTAMP: {
+        NumericVector nvec(size);
+        int64_t* out = reinterpret_cast<int64_t*>(REAL(nvec));
+        for (R_xlen_t i = 0; i < size; ++i) {
+          const Group_Key& key = keys[order[i]];
+          out[i] = key.na ? NA_INTEGER64 : key.int_value;
+        }
+        RParquet_Reader::set_type_class(type, nvec);
+        return nvec;
+      }
+      default: {
+        CharacterVector cvec(size);
+        cetype_t encoding = type == arrow::Type::type::STRING ? CE_UTF8 : CE_NATIVE;
+        for (R_xlen_t i = 0; i < size; ++i) {
+          const Group_Key& key = keys[order[i]];
+          cvec[i] = key.na ? NA_STRING : Rf_mkCharLenCE(key.str_value.data(), key.str_value.size(), encoding);
+        }
+        return cvec;
+      }
+    }
+  }
+
+  // count and null_count are numbers, mean a double and sum a double or, for
+  // integer64 columns, an integer64 (0 and NaN for a group without values, as
+  // sum and mean with na.rm do), min and max of the R type of the column (NA
+  // for a group without values). The sum and mean of an integer column are
+  // NA, with a warning, when the sum overflows an int64.
+  SEXP fun_col(size_t c, const std::string& fun, const std::vector<int>& order) {
+    R_xlen_t size = order.size();
+    auto state = [&](R_xlen_t i) -> const Aggregate_State& { return m_total.states[order[i] * m_cols.size() + c]; };
+    if (fun == "min" || fun == "max") {
+      return min_max_col(m_cols[c], fun == "max", size, state);
+    }
+    arrow::Type::type type = m_reader.col_type(m_cols[c]);
+    bool is_double = type == arrow::Type::type::DOUBLE;
+    bool overflow = false;
+    NumericVector nvec(size);
+    if (fun == "sum" && type == arrow::Type::type::INT64) {
+      int64_t* out = reinterpret_cast<int64_t*>(REAL(nvec));
+      for (R_xlen_t i = 0; i < size; ++i) {
+        const Aggregate_State& s = state(i);
+        overflow |= s.sum_overflow;
+        out[i] = s.sum_overflow ? NA_INTEGER64 : s.int_sum;
+      }
+      RParquet_Reader::set_type_class(type, nvec);
+    } else {
+      for (R_xlen_t i = 0; i < size; ++i) {
+        const Aggregate_State& s = state(i);
+        double sum = is_double ? s.sum : static_cast<double>(s.int_sum);
+        if (fun == "count") {
+          nvec[i] = s.count;
+        } else if (fun == "null_count") {
+          nvec[i] = s.null_count;
+        } else if (!is_double && s.sum_overflow) {
+          overflow = true;
+          nvec[i] = NA_REAL;
+        } else if (fun == "sum") {
+          nvec[i] = sum;
+        } else {
+          nvec[i] = s.count == 0 ? R_NaN : sum / s.count;
+        }
+      }
+    }
+    if (overflow) {
+      warning("The %s of column %s overflows int64, NA returned", fun, m_reader.col_name(m_cols[c]));
+    }
+    return nvec;
+  }
+
+  template <typename StateFunc>
+  SEXP min_max_col(int col_idx, bool max, R_xlen_t size, StateFunc state) {
+    arrow::Type::type type = m_reader.col_type(col_idx);
+    switch (type) {
+      case arrow::Type::type::INT32:
+      case arrow::Type::type::BOOL: {
+        IntegerVector ivec(size);
+        for (R_xlen_t i = 0; i < size; ++i) {
+          const Aggregate_State& s = state(i);
+          ivec[i] = s.has_min_max ? static_cast<int>(max ? s.int_max : s.int_min) : NA_INTEGER;
+        }
+        if (type == arrow::Type::type::BOOL) {
+          return LogicalVector(ivec);
+        }
+        return ivec;
+      }
+      case arrow::Type::type::INT64:
+      case arrow::Type::type::TIMESTAMP: {
+        NumericVector nvec(size);
+        int64_t* out = reinterpret_cast<int64_t*>(REAL(nvec));
+        for (R_xlen_t i = 0; i < size; ++i) {
+          const Aggregate_State& s = state(i);
+          out[i] = s.has_min_max ? (max ? s.int_max : s.int_min) : NA_INTEGER64;
+        }
+        RParquet_Reader::set_type_class(type, nvec);
+        return nvec;
+      }
+      case arrow::Type::type::DOUBLE: {
+        NumericVector nvec(size);
+        for (R_xlen_t i = 0; i < size; ++i) {
+          const Aggregate_State& s = state(i);
+          nvec[i] = s.has_min_max ? (max ? s.dbl_max : s.dbl_min) : NA_REAL;
+        }
+        return nvec;
+      }
+      default: {
+        CharacterVector cvec(size);
+        cetype_t encoding = type == arrow::Type::type::STRING ? CE_UTF8 : CE_NATIVE;
+        for (R_xlen_t i = 0; i < size; ++i) {
+          const Aggregate_State& s = state(i);
+          const std::string& value = max ? s.str_max : s.str_min;
+          cvec[i] = s.has_min_max ? Rf_mkCharLenCE(value.data(), value.size(), encoding) : NA_STRING;
+        }
+        return cvec;
+      }
+    }
+  }
+
+  static const int m_read_row_size = 100000;
+  RParquet_Reader          m_reader;
+  std::vector<std::string> m_col_names;
+  std::vector<std::string> m_funs;
+  std::vector<std::string> m_by_name;
+  int                      m_threads;
+  int                      m_verbose;
+  int                      m_by_col;
+  bool                     m_from_stats;
+  bool                     m_need_min_max;
+  std::vector<int>         m_cols;
+  std::mutex               m_mutex;
+  Partial                  m_total;
+  int                      m_stats_groups;
+};
+#ifdef RPARQUET_ALTREP
+
+// Columns of a lazy read are ALTREP vectors decoding the row groups of their
+// column on first access: all of them when the data pointer is asked for,
+// the ones holding the rows otherwise. data1 holds the Lazy_Column, data2 the
+// plain vector being filled, null until the first access.
+
+// The reader that planned the read, shared by the columns of the data frame,
+// and the row groups of the column already in the vector. The file is only
+// open while row groups are decoded. Main thread only.
+struct Lazy_Column {
+  std::shared_ptr<RParquet_Reader> reader;
+  int                              col_idx;
+  R_xlen_t                         length;
+  std::vector<bool>                decoded;
+  int                              groups_left;
+  std::unique_ptr<CharSXP_Cache>   cache;
+};
+
+static R_altrep_class_t lazy_real_class;
+static R_altrep_class_t lazy_integer_class;
+static R_altrep_class_t lazy_logical_class;
+static R_altrep_class_t lazy_string_class;
+
+static Lazy_Column& lazy_column(SEXP x) {
+  return *static_cast<Lazy_Column*>(R_ExternalPtrAddr(R_altrep_data1(x)));
+}
+
+// ALTREP methods are called from C: an exception is turned into an R error,
+// and a jump of R out of the decoding resumed, once the frames holding C++
+// objects are gone.
+template <typename FuncType>
+static auto lazy_guard(FuncType f) -> decltype(f()) {
+  char message[1024];
+  SEXP token = nullptr;
+  try {
+    return f();
+  } catch (R_Unwind& e) {
+    token = e.token;
+  } catch (std::exception& e) {
+    std::snprintf(message, sizeof(message), "%s", e.what());
+  }
+  if (token != nullptr) {
+    continue_unwind(R_Unwind{token});
+  }
+  Rf_error("%s", message);
+}
+
+// Keeps the file of a reader open while row groups are decoded, closing it
+// also when decoding throws.
+class Lazy_File {
+public:
+  ~Lazy_File() {
+    if (m_reader != nullptr) {
+      m_reader->close_file();
+    }
+  }
+
+  void open(RParquet_Reader& reader) {
+    if (m_reader == nullptr) {
+      reader.open_file();
+      m_reader = &reader;
+    }
+  }
+
+private:
+  RParquet_Reader* m_reader = nullptr;
+};
+
+// Decodes the row groups of [first_group, last_group) not in the vector yet
+// and returns the vector.
+static SEXP lazy_decode(SEXP x, int first_group, int last_group) {
+  Lazy_Column& col = lazy_column(x);
+  SEXP vec = R_altrep_data2(x);
+  if (vec == R_NilValue) {
+    vec = Rf_allocVector(TYPEOF(x), col.length);
+    R_set_altrep_data2(x, vec);
+  }
+  if (col.groups_left == 0) {
+    return vec;
+  }
+  RParquet_Reader& reader = *col.reader;
+  const std::vector<int64_t>& offsets = reader.group_out_offsets();
+  std::vector<std::function<void()>> tasks;
+  std::vector<int> groups;
+  Lazy_File file;
+  for (int group_idx = first_group; group_idx < last_group;) {
+    if (col.decoded[group_idx]) {
+      ++group_idx;
+      continue;
+    }
+    int end = group_idx + 1;
+    while (end < last_group && !col.decoded[end]) {
+      ++end;
+    }
+    file.open(reader);
+    if (TYPEOF(vec) == STRSXP) {
+      std::vector<std::shared_ptr<arrow::Array>> arrays = reader.read_chunks(col.col_idx, group_idx, end);
+      reader.fill_string_col(col.col_idx, RParquet_Reader::chunk_source(arrays), vec, offsets[group_idx],
+                             *col.cache, group_idx, end);
+    } else {
+      reader.add_col_tasks(col.col_idx, group_idx, end, vec, offsets[group_idx], tasks);
+    }
+    for (; group_idx < end; ++group_idx) {
+      groups.push_back(group_idx);
+    }
+  }
+  if (groups.empty()) {
+    return vec;
+  }
+  run_tasks(tasks, reader.threads());
+  for (auto &group_idx : groups) {
+    col.decoded[group_idx] = true;
+  }
+  col.groups_left -= groups.size();
+  if (col.groups_left == 0) {
+    // The vector now keeps every CHARSXP alive on its own.
+    col.cache.reset();
+  }
+  return vec;
+}
+
+static SEXP lazy_decode_all(SEXP x) {
+  return lazy_decode(x, 0, lazy_column(x).decoded.size());
+}
+
+// Decodes the row groups holding the rows [first, last) and returns the
+// vector.
+static SEXP lazy_rows(SEXP x, R_xlen_t first, R_xlen_t last) {
+  const std::vector<int64_t>& offsets = lazy_column(x).reader->group_out_offsets();
+  auto group_of = [&](R_xlen_t i) {
+    return static_cast<int>(std::upper_bound(offsets.begin(), offsets.end(), i) - offsets.begin() - 1);
+  };
+  return lazy_decode(x, group_of(first), group_of(last - 1) + 1);
+}
+
+static R_xlen_t lazy_length(SEXP x) {
+  return lazy_column(x).length;
+}
+
+static Rboolean lazy_inspect(SEXP x, int, int, int, void (*)(SEXP, int, int, int)) {
+  Lazy_Column& col = lazy_column(x);
+  Rprintf("rparquet lazy column %s of %s, %d of %d row groups not decoded\n",
+          col.reader->col_name(col.col_idx).c_str(), col.reader->filename().c_str(),
+          col.groups_left, static_cast<int>(col.decoded.size()));
+  return TRUE;
+}
+
+static void* lazy_dataptr(SEXP x, Rboolean) {
+  return lazy_guard([&]() { return DATAPTR(lazy_decode_all(x)); });
+}
+
+static const void* lazy_dataptr_or_null(SEXP x) {
+  SEXP vec = R_altrep_data2(x);
+  return vec != R_NilValue && lazy_column(x).groups_left == 0 ? DATAPTR(vec) : nullptr;
+}
+
+template <typename T>
+static T lazy_elt(SEXP x, R_xlen_t i) {
+  return lazy_guard([&]() { return static_cast<const T*>(DATAPTR(lazy_rows(x, i, i + 1)))[i]; });
+}
+
+template <typename T>
+static R_xlen_t lazy_get_region(SEXP x, R_xlen_t i, R_xlen_t n, T* buf) {
+  return lazy_guard([&]() {
+    R_xlen_t size = std::min(n, lazy_column(x).length - i);
+    if (size <= 0) {
+      return static_cast<R_xlen_t>(0);
+    }
+    const T* values = static_cast<const T*>(DATAPTR(lazy_rows(x, i, i + size)));
+    std::copy(values + i, values + i + size, buf);
+    return size;
+  });
+}
+
+static SEXP lazy_string_elt(SEXP x, R_xlen_t i) {
+  return lazy_guard([&]() { return STRING_ELT(lazy_rows(x, i, i + 1), i); });
+}
+
+// A string set before the whole column is decoded could free a CHARSXP the
+// cache still points to, so the column is decoded first.
+static void lazy_set_string_elt(SEXP x, R_xlen_t i, SEXP value) {
+  Shield<SEXP> protect(value);
+  lazy_guard([&]() { SET_STRING_ELT(lazy_decode_all(x), i, value); });
+}
+
+static SEXP new_lazy_col(const std::shared_ptr<RParquet_Reader>& reader, int col_idx, R_xlen_t length) {
+  XPtr<Lazy_Column> col(new Lazy_Column{reader, col_idx, length, std::vector<bool>(reader->row_groups(), false),
+                                        reader->row_groups(), nullptr}, true);
+  R_altrep_class_t cls = lazy_string_class;
+  switch (reader->col_sexptype(col_idx)) {
+    case REALSXP:
+      cls = lazy_real_class;
+      break;
+    case INTSXP:
+      cls = lazy_integer_class;
+      break;
+    case LGLSXP:
+      cls = lazy_logical_class;
+      break;
+    default:
+      col->cache.reset(new CharSXP_Cache(reader->string_cache(col_idx)));
+      break;
+  }
+  RObject x = R_new_altrep(cls, col, R_NilValue);
+  reader->set_col_class(col_idx, x);
+  return x;
+}
+
+#endif // RPARQUET_ALTREP
+
+// The data frame of a lazy read: the columns are decoded on first access,
+// except for factors, whose levels need every row and are read at once.
+static List lazy_df(const std::shared_ptr<RParquet_Reader>& reader) {
+#ifdef RPARQUET_ALTREP
+  int selected_col_size = reader->col_idx_set().size();
+  int capacity = reader->selected_rows();
+  List col_list(selected_col_size);
+  List col_name(selected_col_size);
+  int index = 0;
+  for (auto &col_idx : reader->col_idx_set()) {
+    col_name[index] = reader->col_name(col_idx - 1);
+    if (reader->is_string_col(col_idx - 1) && reader->is_factor_col(col_idx - 1)) {
+      col_list[index] = reader->read_factor_col(col_idx - 1, capacity, 0, reader->row_groups());
+    } else {
+      col_list[index] = new_lazy_col(reader, col_idx - 1, capacity);
+    }
+    index++;
+  }
+  reader->close_file();
+  col_list.attr("names") = col_name;
+  col_list.attr("row.names") = IntegerVector::create(NA_INTEGER, -capacity);
+  col_list.attr("class") = "data.frame";
+  SEXP profile = reader->take_profile();
+  if (profile != R_NilValue) {
+    col_list.attr("rparquet_profile") = profile;
+  }
+  return col_list;
+#else
+  stop("Lazy columns need R 3.6.0 or later");
+#endif
+}
+
+} // namespace RParquet
+
+// Registers the ALTREP classes of the lazy columns. The token of
+// unwind_protect() is made here, out of any decoding.
+// [[Rcpp::init]]
+void rparquet_init_altrep(DllInfo* dll) {
+  RParquet::unwind_token();
+#ifdef RPARQUET_ALTREP
+  using namespace RParquet;
+  lazy_real_class = R_make_altreal_class("rparquet_lazy_real", "RParquet", dll);
+  lazy_integer_class = R_make_altinteger_class("rparquet_lazy_integer", "RParquet", dll);
+  lazy_logical_class = R_make_altlogical_class("rparquet_lazy_logical", "RParquet", dll);
+  lazy_string_class = R_make_altstring_class("rparquet_lazy_string", "RParquet", dll);
+  for (auto cls : {lazy_real_class, lazy_integer_class, lazy_logical_class, lazy_string_class}) {
+    R_set_altrep_Length_method(cls, lazy_length);
+    R_set_altrep_Inspect_method(cls, lazy_inspect);
+    R_set_altvec_Dataptr_method(cls, lazy_dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, lazy_dataptr_or_null);
+  }
+  R_set_altreal_Elt_method(lazy_real_class, lazy_elt<double>);
+  R_set_altreal_Get_region_method(lazy_real_class, lazy_get_region<double>);
+  R_set_altinteger_Elt_method(lazy_integer_class, lazy_elt<int>);
+  R_set_altinteger_Get_region_method(lazy_integer_class, lazy_get_region<int>);
+  R_set_altlogical_Elt_method(lazy_logical_class, lazy_elt<int>);
+  R_set_altlogical_Get_region_method(lazy_logical_class, lazy_get_region<int>);
+  R_set_altstring_Elt_method(lazy_string_class, lazy_string_elt);
+  R_set_altstring_Set_elt_method(lazy_string_class, lazy_set_string_elt);
+#endif
+}
+
+// [[Rcpp::export]]
+List read_parquet(std::string filename, IntegerVector selected_col, LogicalVector filter, List where, NumericVector row_from, NumericVector row_to, bool as_factor, int read_row_size, int threads, List io_options, bool lazy, bool profile, int verbose) {
+  return RParquet::unwind_boundary([&]() {
+    if (lazy) {
+      auto rp_reader = std::make_shared<RParquet::RParquet_Reader>(filename, selected_col, filter, where, row_from, row_to, as_factor, read_row_size, threads, io_options, profile, verbose);
+      rp_reader->init();
+      return RParquet::lazy_df(rp_reader);
+    }
+    RParquet::RParquet_Reader rp_reader(filename, selected_col, filter, where, row_from, row_to, as_factor, read_row_size, threads, io_options, profile, verbose);
+    rp_reader.init();
+    return List(rp_reader.create_df());
+  });
+}
+
+// [[Rcpp::export]]
+SEXP open_parquet(std::string filename, IntegerVector selected_col, LogicalVector filter, List where, NumericVector row_from, NumericVector row_to, bool as_factor, int read_row_size, int threads, List io_options, bool profile, int verbose) {
+  XPtr<RParquet::RParquet_Reader> rp_reader(
+      new RParquet::RParquet_Reader(filename, selected_col, filter, where, row_from, row_to, as_factor, read_row_size, threads, io_options, profile, verbose), true);
+  rp_reader->init();
+  return rp_reader;
+}
+
+// [[Rcpp::export]]
+SEXP read_parquet_batch(SEXP reader, int batch_rows) {
+  return RParquet::unwind_boundary([&]() {
+    XPtr<RParquet::RParquet_Reader> rp_reader(reader);
+    return rp_reader->next_batch(batch_rows);
+  });
+}
+
+// [[Rcpp::export]]
+List read_parquet_dataset(CharacterVector filenames, IntegerVector selected_col, List where, bool as_factor, int threads, List io_options, int verbose) {
+  return RParquet::unwind_boundary([&]() {
+    RParquet::RParquet_Dataset rp_dataset(filenames, selected_col, where, as_factor, threads, io_options, verbose);
+    rp_dataset.init();
+    return rp_dataset.create_df();
+  });
+}
+
+// [[Rcpp::export]]
+DataFrame read_metadata(std::string filename, bool details = false, bool profile = false) {
+  const std::string names[6] = {
+        "COL_NAME", "COL_PHY_TYPE", "COL_LOG_TYPE",
+        "COL_EMPTY_VALUES", "COL_TOTAL_COMPRESSED_SIZE",
+        "COL_TOTAL_UNCOMPRESSED_SIZE" };
+  std::vector <std::vector<std::string>> column_meta(3);
+
+  DataFrame df = DataFrame::create();
+  RParquet::Profile metadata_profile;
+  RParquet::Profile::Time_Point start = RParquet::Profile::now();
+  std::shared_ptr<RParquet::Cached_Metadata> cached = RParquet::cached_metadata(filename);
+  std::shared_ptr<parquet::FileMetaData> file_metadata = cached->metadata();
+  metadata_profile.add("footer", -1, -1, RParquet::Profile::since(start), file_metadata->size(), file_metadata->num_rows());
+  start = RParquet::Profile::now();
+  int num_row_groups = file_metadata->num_row_groups();
+  int num_columns = file_metadata->num_columns();
+
+  // File meta information
+  CharacterVector fmeta_vec;
+  fmeta_vec.push_back("Filename : " + filename);
+  fmeta_vec.push_back("Row Groups : " + std::to_string(num_row_groups));
+  fmeta_vec.push_back("Total Rows : " + std::to_string(file_metadata->num_rows()));
   fmeta_vec.push_back("Number of Columns : " + std::to_string(num_columns));
   df.push_back(fmeta_vec, "FILE_META");
 
@@ -349,38 +3297,98 @@ DataFrame read_metadata(std::string filename, bool details = false) {
   }
 
   if (details) {
+    // Totals over the row groups, the null count is NA when a chunk has no
+    // statistics.
+    std::vector<int64_t> null_count(num_columns, 0);
+    std::vector<int64_t> compressed_size(num_columns, 0);
+    std::vector<int64_t> uncompressed_size(num_columns, 0);
     for (int idx = 0; idx < num_row_groups; ++idx) {
       auto group_metadata = file_metadata->RowGroup(idx);
       for (int col_idx = 0; col_idx < num_columns; ++col_idx) {
         auto column_chunk = group_metadata->ColumnChunk(col_idx);
-        std::shared_ptr < parquet::RowGroupStatistics > stats = column_chunk->statistics();
-        Rcout << " Column " << col_idx << " ,Values: " << column_chunk->num_values() << "\n";
-        Rcout << " Column " << col_idx << " ,uncompsize/compsize " << column_chunk->total_uncompressed_size() << "/"<< column_chunk->total_compressed_size() << "\n";
-        if (idx == 0) {
-          if (column_chunk->is_stats_set()) {
-            Rcout << stats->null_count() << "\n";
-            column_meta[3].push_back(std::to_string(stats->null_count()));
-          }
-          column_meta[4].push_back(std::to_string(column_chunk->total_compressed_size()));
-          column_meta[5].push_back(std::to_string(column_chunk->total_uncompressed_size()));
+        std::shared_ptr < parquet::RowGroupStatistics > stats = cached->statistics(idx, col_idx);
+        if (stats == nullptr || null_count[col_idx] < 0) {
+          null_count[col_idx] = -1;
         } else {
-          if (column_chunk->is_stats_set()) {
-            auto & empty_val = column_meta[3][col_idx];
-            empty_val = std::to_string(std::stoi(empty_val) + stats->null_count());
-          }
-          auto &total_compress =  column_meta[3][col_idx];
-          total_compress = std::to_string(std::stoi(total_compress) + column_chunk->total_compressed_size());
-          auto &total_uncompress = column_meta[4][col_idx];
-          total_uncompress = std::to_string(std::stoi(total_uncompress) + column_chunk->total_uncompressed_size());
+          null_count[col_idx] += stats->null_count();
         }
+        compressed_size[col_idx] += column_chunk->total_compressed_size();
+        uncompressed_size[col_idx] += column_chunk->total_uncompressed_size();
       }
     }
-    for (int i = 3; i < 6; ++i) {
-      CharacterVector rcpp_vec;
-      rcpp_vec.assign(column_meta[i].begin(), column_meta[i].end());
-      df.push_back(rcpp_vec, names[i]);
+    NumericVector null_vec(num_columns);
+    NumericVector compressed_vec(num_columns);
+    NumericVector uncompressed_vec(num_columns);
+    for (int col_idx = 0; col_idx < num_columns; ++col_idx) {
+      null_vec[col_idx] = null_count[col_idx] < 0 ? NA_REAL : null_count[col_idx];
+      compressed_vec[col_idx] = compressed_size[col_idx];
+      uncompressed_vec[col_idx] = uncompressed_size[col_idx];
     }
- }
+    df.push_back(null_vec, names[3]);
+    df.push_back(compressed_vec, names[4]);
+    df.push_back(uncompressed_vec, names[5]);
+  }
+  if (profile) {
+    metadata_profile.add(details ? "statistics" : "schema", -1, -1, RParquet::Profile::since(start));
+    df.attr("rparquet_profile") = metadata_profile.take(std::vector<std::string>());
+  }
   return df;
 }
 
+// [[Rcpp::export]]
+DataFrame read_stats(CharacterVector filenames, int threads) {
+  RParquet::RParquet_Stats rp_stats(filenames, threads);
+  rp_stats.init();
+  return rp_stats.create_df();
+}
+
+// [[Rcpp::export]]
+DataFrame read_aggregate(std::string filename, CharacterVector columns, CharacterVector funs, List where, CharacterVector by, int threads, List io_options, int verbose) {
+  RParquet::RParquet_Aggregate rp_aggregate(filename, columns, funs, where, by, threads, io_options, verbose);
+  rp_aggregate.init();
+  return rp_aggregate.create_df();
+}
+
+// [[Rcpp::export]]
+List metadata_cache_info() {
+  RParquet::Metadata_Cache& cache = RParquet::Metadata_Cache::instance();
+  std::vector<RParquet::Metadata_Cache::Entry_Info> entries = cache.entries();
+  CharacterVector path(entries.size());
+  NumericVector size(entries.size());
+  NumericVector mtime(entries.size());
+  NumericVector footer_size(entries.size());
+  NumericVector bytes(entries.size());
+  NumericVector hits(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    path[i] = entries[i].path;
+    size[i] = entries[i].size;
+    mtime[i] = entries[i].mtime / 1e9;
+    footer_size[i] = entries[i].footer_size;
+    bytes[i] = entries[i].bytes;
+    hits[i] = entries[i].hits;
+  }
+  DataFrame files = DataFrame::create(Named("path") = path, Named("size") = size, Named("mtime") = mtime,
+                                      Named("footer_size") = footer_size, Named("bytes") = bytes,
+                                      Named("hits") = hits,
+                                      Named("stringsAsFactors") = false);
+  return List::create(Named("files") = files,
+                      Named("capacity") = static_cast<double>(cache.capacity()),
+                      Named("used") = static_cast<double>(cache.used()),
+                      Named("hits") = static_cast<double>(cache.hits()),
+                      Named("misses") = static_cast<double>(cache.misses()));
+}
+
+// [[Rcpp::export]]
+int metadata_cache_clear() {
+  RParquet::Metadata_Cache::instance().clear();
+  return 0;
+}
+
+// [[Rcpp::export]]
+int metadata_cache_capacity(double capacity) {
+  if (!(capacity >= 0)) {
+    stop("Cache capacity should not be negative.");
+  }
+  RParquet::Metadata_Cache::instance().set_capacity(static_cast<int64_t>(capacity));
+  return 0;
+}
@@ -3,38 +3,140 @@
 #include <parquet/arrow/reader.h>
 #include <parquet/arrow/writer.h>
 #include <parquet/exception.h>
+#include <arrow/util/bit-util.h>
 #include <Rcpp.h>
 #include <unordered_map>
+#include <limits>
+#include <numeric>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <sys/stat.h>
+#include "rparquet_tasks.h"
+#include "rparquet_profile.h"
 
 using namespace Rcpp;
 using arrow::Type;
 
 namespace RParquet {
+static std::shared_ptr<arrow::Buffer> allocate_buffer(int64_t size) {
+  std::shared_ptr<arrow::Buffer> buffer;
+  PARQUET_THROW_NOT_OK(arrow::AllocateBuffer(memory_pool(), size, &buffer));
+  return buffer;
+}
+
+// Packs pred(values[i]) into the bitmap bits, 64 rows to a word, and returns
+// the number of bits set.
+template <typename ValueType, typename Pred>
+static int64_t pack_bits(const ValueType* values, int64_t length, Pred pred, uint8_t* bits) {
+  int64_t count = 0;
+  int64_t i = 0;
+  for (; i + 64 <= length; i += 64) {
+    uint64_t word = 0;
+    for (int j = 0; j < 64; ++j) {
+      word |= static_cast<uint64_t>(pred(values[i + j])) << j;
+    }
+    std::memcpy(bits + i / 8, &word, sizeof(word));
+    count += __builtin_popcountll(word);
+  }
+  if (i < length) {
+    uint64_t word = 0;
+    for (int64_t j = 0; i + j < length; ++j) {
+      word |= static_cast<uint64_t>(pred(values[i + j])) << j;
+    }
+    std::memcpy(bits + i / 8, &word, arrow::BitUtil::BytesForBits(length - i));
+    count += __builtin_popcountll(word);
+  }
+  return count;
+}
+
+// Builds the validity bitmap of values and returns the null count. Drops the
+// bitmap when nothing is null, which arrow takes as all valid.
+template <typename ValueType, typename IsNull>
+static int64_t make_validity(const ValueType* values, int64_t length, IsNull is_null,
+                             std::shared_ptr<arrow::Buffer>* bitmap) {
+  *bitmap = allocate_buffer(arrow::BitUtil::BytesForBits(length));
+  int64_t valid_count = pack_bits(values, length, [&](const ValueType& x) { return !is_null(x); },
+                                  (*bitmap)->mutable_data());
+  if (valid_count == length) {
+    bitmap->reset();
+  }
+  return length - valid_count;
+}
+
+// Wraps the memory of an R vector as an arrow array without copying it. The
+// array must not outlive the vector. values may also be those of data, the
+// buffer they were gathered into.
+template <typename ValueType, typename IsNull>
+static std::shared_ptr<arrow::Array> wrap_vector(const std::shared_ptr<arrow::DataType>& type,
+                                                 const ValueType* values, int64_t length, IsNull is_null,
+                                                 std::shared_ptr<arrow::Buffer> data = nullptr) {
+  if (data == nullptr) {
+    data = std::make_shared<arrow::Buffer>(reinterpret_cast<const uint8_t*>(values), length * sizeof(ValueType));
+  }
+  std::shared_ptr<arrow::Buffer> bitmap;
+  int64_t null_count = make_validity(values, length, is_null, &bitmap);
+  return arrow::MakeArray(arrow::ArrayData::Make(type, length, {bitmap, data}, null_count));
+}
+
+// Where the workers find the values of a column: the memory of the R vector,
+// kept alive by vec, and for a factor the strings of its levels. rows
+// holds the 1-based rows in writing order, null for the order of the vector.
+struct Column_Data {
+  int                              col_idx;
+  Type::type                       type;
+  RObject                          vec;
+  const void*                      values;
+  const int*                       rows;
+  const SEXP*                      levels;
+};
+
 class Rparquet_Writer {
 public:
-  Rparquet_Writer(DataFrame &df,
-                  std::string filename,
-                  CharacterVector col_types,
+  Rparquet_Writer(std::string filename,
                   IntegerVector col_idx,
                   int group_rows,
+                  int threads,
+                  List options,
+                  bool profile,
                   int v_flag):
-        m_df(df),
         m_filename(filename),
-        m_col_types(as<std::vector<std::string>>(col_types)),
         m_col_idx(as<std::vector<int>>(col_idx)),
         m_rows_per_group(group_rows),
-        m_verbose(v_flag) {
+        m_threads(threads),
+        m_options(options),
+        m_verbose(v_flag),
+        m_rows(0),
+        m_row_groups(0),
+        m_failed(false),
+        m_profile(profile ? new Profile() : nullptr) {
   }
 
   ~Rparquet_Writer() {
+    // A handle dropped without rparquet_close_writer() still gets its footer.
+    // Runs from the finalizer of the handle, so it does not print.
+    try {
+      finish();
+    } catch (...) {
+    }
   }
+
   using BufferVector = std::vector<std::shared_ptr<arrow::Buffer>>;
-  void init() {
-    m_cols = m_df.length();
-    m_rows = m_df.nrows();
-    m_row_groups = 1;
-    m_row_remainder = 0;
-    m_col_names = as<std::vector<std::string>>(m_df.names());
+
+  // Opens the file with the schema of the selected columns of the first data
+  // frame, later ones must have the same columns. Returns false when a column
+  // type is not supported.
+  bool init(DataFrame &df, CharacterVector col_types) {
+    if (m_failed) {
+      stop("A write to the parquet file failed, the file was removed.");
+    }
+    if (m_rows_per_group < 1) {
+      stop("Group rows should greater than 0.");
+    }
+    m_cols = df.length();
+    m_col_types = as<std::vector<std::string>>(col_types);
+    m_col_names = as<std::vector<std::string>>(df.names());
 
     if (m_col_idx.size() == 1 && m_col_idx[0] == -1) {
       int i = 1;
@@ -49,172 +151,480 @@ public:
       stop("ERROR:No valid column has been selected\n");
     }
 
-    if (m_rows > m_rows_per_group) {
-      m_row_groups = m_rows / m_rows_per_group;
-      m_row_remainder = m_rows % m_rows_per_group;
-    } else {
-      m_rows_per_group = m_rows;
+    for (const auto & idx : m_col_idx_set) {
+      auto index = idx-1;
+      auto type = m_parquet_type_map.find(m_col_types[index]);
+      if (type == m_parquet_type_map.end()) {
+       Rcout << "ERROR:Unknown parquet data type " << m_col_types[index] << "\n";
+       return false;
+      }
+      m_col_arrow_types.push_back(type->second);
+      // Factors are written as strings: the arrow writer of this parquet-cpp
+      // casts a dictionary array back to dense strings before encoding, so
+      // the levels are expanded in make_array, and the column chunks are
+      // dictionary encoded by parquet like any string column. The schema
+      // then does not depend on the levels of a data frame.
+      m_table_fields.emplace_back(arrow::field(m_col_names[index], type->second == Type::type::DICTIONARY ?
+                                               arrow::utf8() : arrow_type(type->second)));
     }
     if (m_verbose == 1) {
        Rcout << "\n";
        Rcout << "FILE TO WRITE: " << m_filename << "\n";
-       Rcout << "TOTAL ROWS:" << m_rows<<"\n";
        Rcout << "TOTAL COLS:" << m_cols<<"\n";
        Rcout << "SELECTED COLUMNS:\n";
        for (auto &e : m_col_idx_set) {
          Rcout << "[id:"<< e << ", name:" << m_col_names[e-1] <<", type:" << m_col_types[e-1] << "]" <<"\n";
        }
-       Rcout << "ROW GROUPS:" << m_row_groups<<"\n";
        Rcout << "ROWS/GROUP:" << m_rows_per_group <<"\n";
-       Rcout << "ROW REMAINDER:" << m_row_remainder <<"\n";
      }
+    Profile::Time_Point start = Profile::now();
+    std::shared_ptr<arrow::io::FileOutputStream> outfile;
+    PARQUET_THROW_NOT_OK(arrow::io::FileOutputStream::Open(m_filename, &outfile));
+    m_out_file = outfile;
+    PARQUET_THROW_NOT_OK(parquet::arrow::FileWriter::Open(*arrow::schema(m_table_fields), memory_pool(),
+                                                          m_out_file, make_properties(),
+                                                          &m_file_writer));
+    profile_phase("open", -1, -1, start);
+    return true;
   }
 
-  void write_parquet() {
-    for (const auto & idx : m_col_idx_set) {
-      auto index = idx-1;
-      auto type = m_parquet_type_map.find(m_col_types[index]);
-      if (type == m_parquet_type_map.end()) {
-       Rcout << "ERROR:Unknown parquet data type " << m_col_types[index] << "\n";
-       return;
+  bool is_open() const {
+    return m_file_writer != nullptr;
+  }
+
+  // The arrow type written for the R class of a column, false when the class
+  // is not supported.
+  static bool column_type(const std::string& col_type, Type::type* type) {
+    auto it = m_parquet_type_map.find(col_type);
+    if (it == m_parquet_type_map.end()) {
+      return false;
+    }
+    *type = it->second;
+    return true;
+  }
+
+  // Writes the data frame a row group at a time. The columns of a row group
+  // are converted on the workers while the previous row group is encoded, so
+  // the arrow arrays of at most two row groups exist at once. The last row
+  // group of each data frame may be shorter than the group rows. When given,
+  // row_order holds the 1-based rows to write in their order, each row group
+  // gathering its rows while it is converted instead of the data frame being
+  // reordered as a whole.
+  void write_parquet(DataFrame &df, CharacterVector col_types, IntegerVector row_order = IntegerVector()) {
+    if (!is_open()) {
+      stop("The parquet writer is closed.");
+    }
+    std::vector<std::string> types = as<std::vector<std::string>>(col_types);
+    if (df.length() != m_cols || types != m_col_types) {
+      stop("The data frame columns do not match the columns of the file.");
+    }
+    int64_t rows = df.nrows();
+    const int* row_ptr = nullptr;
+    if (row_order.size() > 0) {
+      if (std::any_of(row_order.begin(), row_order.end(), [rows](int row) { return row < 1 || row > rows; })) {
+        stop("Row order out of the rows of the data frame.");
       }
-      switch(m_parquet_type_map.at(m_col_types[index])) {
-      case Type::type::TIMESTAMP: {
-        NumericVector nv = m_df[index];
-        arrow::TimestampBuilder builder(arrow::timestamp(arrow::TimeUnit::NANO), arrow::default_memory_pool());
-        std::vector<int64_t> i64vec(nv.size());
-        std::vector<bool> is_valid(nv.size(), true);
-        for (int i = 0; i < nv.size(); ++i) {
-          if( nv[i] == -0) {
-            is_valid[i] = false;
-          }
-          int64_t x = 0;
-          memcpy(&x, &nv[i], sizeof(double));
-          i64vec[i] = x;
+      row_ptr = INTEGER(row_order);
+      rows = row_order.size();
+    }
+    int64_t row_groups = (rows + m_rows_per_group - 1) / m_rows_per_group;
+    if (m_verbose == 1) {
+       Rcout << "ROWS TO WRITE:" << rows <<"\n";
+       Rcout << "ROW GROUPS:" << row_groups <<"\n";
+       Rcout << "ROW REMAINDER:" << rows % m_rows_per_group <<"\n";
+    }
+    // A failure from here on may leave part of the data frame in the file.
+    try {
+      std::vector<Column_Data> cols;
+      int col = 0;
+      for (const auto & idx : m_col_idx_set) {
+        Profile::Time_Point start = Profile::now();
+        cols.push_back(column_data(df[idx - 1], m_col_arrow_types[col++]));
+        cols.back().col_idx = idx - 1;
+        cols.back().rows = row_ptr;
+        profile_phase("prepare", idx - 1, -1, start);
+      }
+      write_row_groups(cols, rows);
+    } catch (...) {
+      discard();
+      throw;
+    }
+    m_rows += rows;
+    m_row_groups += row_groups;
+  }
+
+  // Writes the footer, the file is not readable before.
+  void close() {
+    if (!is_open()) {
+      return;
+    }
+    finish();
+    if (m_verbose == 1) {
+       Rcout << "TOTAL ROWS:" << m_rows<<"\n";
+       Rcout << "TOTAL ROW GROUPS:" << m_row_groups<<"\n";
+    }
+  }
+
+  // The profile entries recorded since the last call, R_NilValue when the
+  // writer does not profile.
+  SEXP take_profile() {
+    if (!m_profile) {
+      return R_NilValue;
+    }
+    return m_profile->take(m_col_names);
+  }
+
+private:
+  // Writes the rows of the columns, see write_parquet().
+  void write_row_groups(const std::vector<Column_Data>& cols, int64_t rows) {
+    std::vector<std::shared_ptr<arrow::Array>> arrays(cols.size());
+    std::vector<std::shared_ptr<arrow::Array>> next_arrays(cols.size());
+    std::vector<std::function<void()>> tasks;
+    add_convert_tasks(cols, 0, std::min<int64_t>(m_rows_per_group, rows), m_row_groups, arrays, tasks);
+    run_tasks(tasks, m_threads);
+    for (int64_t offset = 0; offset < rows; offset += m_rows_per_group) {
+      int64_t length = std::min<int64_t>(m_rows_per_group, rows - offset);
+      int64_t next_offset = offset + m_rows_per_group;
+      int64_t group_idx = m_row_groups + offset / m_rows_per_group;
+      tasks.clear();
+      // Encoding goes first so it starts right away on one worker.
+      tasks.push_back([this, length, group_idx, &cols, &arrays]() {
+        Profile::Time_Point start = Profile::now();
+        PARQUET_THROW_NOT_OK(m_file_writer->NewRowGroup(length));
+        profile_phase("new_row_group", -1, group_idx, start);
+        for (size_t c = 0; c < arrays.size(); ++c) {
+          int64_t position = file_position();
+          start = Profile::now();
+          PARQUET_THROW_NOT_OK(m_file_writer->WriteColumnChunk(*arrays[c]));
+          arrays[c].reset();
+          profile_phase("encode", cols[c].col_idx, group_idx, start, file_position() - position, length);
         }
-        PARQUET_THROW_NOT_OK(builder.AppendValues(i64vec, is_valid));
-        std::shared_ptr<arrow::Array> ary;
-        PARQUET_THROW_NOT_OK(builder.Finish(&ary));
-        m_table_arrays.push_back(ary);
-        m_table_fields.emplace_back(arrow::field(m_col_names[index], arrow::timestamp(arrow::TimeUnit::NANO)));
+      });
+      if (next_offset < rows) {
+        add_convert_tasks(cols, next_offset, std::min<int64_t>(m_rows_per_group, rows - next_offset),
+                          group_idx + 1, next_arrays, tasks);
       }
-        break;
-      case Type::type::INT32: {
-        IntegerVector iv = m_df[index];
-        std::vector<int> ivec = as<std::vector<int>>(iv);
-        arrow::Int32Builder builder;
-        std::vector<bool> is_valid(iv.size(), true);
-        for (int i = 0; i < iv.size(); ++i) {
-          if (IntegerVector::is_na(iv[i])) {
-            is_valid[i] = false;
-          }
+      run_tasks(tasks, m_threads);
+      arrays.swap(next_arrays);
+    }
+  }
+
+  // Writes the footer and closes the file, without the R API.
+  void finish() {
+    if (!is_open()) {
+      return;
+    }
+    Profile::Time_Point start = Profile::now();
+    std::unique_ptr<parquet::arrow::FileWriter> file_writer = std::move(m_file_writer);
+    PARQUET_THROW_NOT_OK(file_writer->Close());
+    int64_t file_bytes = file_position();
+    PARQUET_THROW_NOT_OK(m_out_file->Close());
+    profile_phase("close", -1, -1, start, file_bytes, m_rows);
+  }
+
+  // Drops a file whose write failed part way: the file writer and the stream
+  // are closed, ignoring their errors, and a regular file is removed so no
+  // reader takes its row groups for the whole data. The writer can not be
+  // used anymore.
+  void discard() {
+    m_failed = true;
+    try {
+      m_file_writer.reset();
+      m_out_file->Close();
+    } catch (...) {
+    }
+    m_file_writer.reset();
+    struct stat file_stat;
+    if (::stat(m_filename.c_str(), &file_stat) == 0 && S_ISREG(file_stat.st_mode)) {
+      std::remove(m_filename.c_str());
+    }
+  }
+
+  // Builds the parquet writer properties from the options of the R writer.
+  // An unnamed element of compression, dictionary or statistics sets the file
+  // default, a named one the column of that name.
+  std::shared_ptr<parquet::WriterProperties> make_properties() {
+    parquet::WriterProperties::Builder builder;
+    builder.memory_pool(memory_pool());
+    if (m_options.containsElementNamed("compression")) {
+      CharacterVector codecs = m_options["compression"];
+      for_each_option(codecs, [&](const std::string& col, int i) {
+        auto codec = m_compression_map.find(as<std::string>(codecs[i]));
+        if (codec == m_compression_map.end()) {
+          stop("Unknown compression %s.", as<std::string>(codecs[i]));
+        }
+        if (col.empty()) {
+          builder.compression(codec->second);
+        } else {
+          builder.compression(col, codec->second);
+        }
+      });
+    }
+    if (m_options.containsElementNamed("dictionary")) {
+      LogicalVector dictionary = m_options["dictionary"];
+      for_each_option(dictionary, [&](const std::string& col, int i) {
+        if (col.empty()) {
+          dictionary[i] ? builder.enable_dictionary() : builder.disable_dictionary();
+        } else {
+          dictionary[i] ? builder.enable_dictionary(col) : builder.disable_dictionary(col);
+        }
+      });
+    }
+    if (m_options.containsElementNamed("statistics")) {
+      LogicalVector statistics = m_options["statistics"];
+      for_each_option(statistics, [&](const std::string& col, int i) {
+        if (col.empty()) {
+          statistics[i] ? builder.enable_statistics() : builder.disable_statistics();
+        } else {
+          statistics[i] ? builder.enable_statistics(col) : builder.disable_statistics(col);
         }
-        PARQUET_THROW_NOT_OK(builder.AppendValues(ivec, is_valid));
-        std::shared_ptr<arrow::Array> ary;
-        PARQUET_THROW_NOT_OK(builder.Finish(&ary));
-        m_table_arrays.push_back(ary);
-        m_table_fields.emplace_back(arrow::field(m_col_names[index], arrow::int32()));
+      });
+    }
+    if (m_options.containsElementNamed("page_size")) {
+      double page_size = as<double>(m_options["page_size"]);
+      if (!(page_size >= 1)) {
+        stop("Page size should greater than 0.");
+      }
+      builder.data_pagesize(static_cast<int64_t>(page_size));
+    }
+    return builder.build();
+  }
+
+  // Calls set(column name, i) for each element of an option, the name is
+  // empty for the file default. Names must be selected columns.
+  template <typename Setter>
+  void for_each_option(SEXP values, Setter set) {
+    CharacterVector names = Rf_isNull(Rf_getAttrib(values, R_NamesSymbol)) ?
+                            CharacterVector(Rf_length(values)) : CharacterVector(Rf_getAttrib(values, R_NamesSymbol));
+    for (int i = 0; i < Rf_length(values); ++i) {
+      std::string col = as<std::string>(names[i]);
+      if (!col.empty() && std::none_of(m_col_idx_set.begin(), m_col_idx_set.end(),
+                                       [&](int idx) { return m_col_names[idx - 1] == col; })) {
+        stop("Option for unknown column %s.", col);
+      }
+      set(col, i);
+    }
+  }
+
+  static std::shared_ptr<arrow::DataType> arrow_type(Type::type type) {
+    switch(type) {
+    case Type::type::TIMESTAMP:
+      return arrow::timestamp(arrow::TimeUnit::NANO);
+    case Type::type::INT32:
+      return arrow::int32();
+    case Type::type::INT64:
+      return arrow::int64();
+    case Type::type::DOUBLE:
+      return arrow::float64();
+    case Type::type::BOOL:
+      return arrow::boolean();
+    default:
+      return arrow::utf8();
+    }
+  }
+
+  // Takes what the workers need from a column, on the main thread.
+  static Column_Data column_data(SEXP vec, Type::type type) {
+    Column_Data col;
+    col.type = type;
+    col.rows = nullptr;
+    switch(type) {
+    case Type::type::TIMESTAMP:
+    case Type::type::INT64:
+    case Type::type::DOUBLE: {
+      NumericVector nv = vec;
+      col.values = REAL(nv);
+      col.vec = nv;
+      break;
+    }
+    case Type::type::INT32:
+    case Type::type::DICTIONARY: {
+      IntegerVector iv = vec;
+      col.values = INTEGER(iv);
+      col.vec = iv;
+      break;
+    }
+    case Type::type::BOOL: {
+      LogicalVector lv = vec;
+      col.values = LOGICAL(lv);
+      col.vec = lv;
+      break;
+    }
+    default: {
+      CharacterVector cv = vec;
+      col.values = STRING_PTR(cv);
+      col.vec = cv;
+      break;
+    }
+    }
+    col.levels = nullptr;
+    if (type == Type::type::DICTIONARY) {
+      // The levels are kept alive by the attribute of the factor.
+      CharacterVector levels = col.vec.attr("levels");
+      col.levels = STRING_PTR(levels);
+    }
+    return col;
+  }
+
+  void add_convert_tasks(const std::vector<Column_Data>& cols, int64_t offset, int64_t length, int64_t group_idx,
+                         std::vector<std::shared_ptr<arrow::Array>>& arrays,
+                         std::vector<std::function<void()>>& tasks) {
+    for (size_t c = 0; c < cols.size(); ++c) {
+      tasks.push_back([this, &cols, c, offset, length, group_idx, &arrays]() {
+        Profile::Time_Point start = Profile::now();
+        arrays[c] = make_array(cols[c], offset, length);
+        profile_phase("convert", cols[c].col_idx, group_idx, start, -1, length);
+      });
+    }
+  }
+
+  void profile_phase(const char* phase, int col_idx, int64_t group_idx, Profile::Time_Point start,
+                     int64_t bytes = -1, int64_t rows = -1) {
+    if (m_profile) {
+      m_profile->add(phase, col_idx, group_idx, Profile::since(start), bytes, rows);
+    }
+  }
+
+  // Bytes written to the file so far, only tracked when profiling.
+  int64_t file_position() {
+    int64_t position = 0;
+    if (m_profile) {
+      PARQUET_THROW_NOT_OK(m_out_file->Tell(&position));
+    }
+    return position;
+  }
+
+  // The values of the rows [offset, offset + length) of a column in writing
+  // order: the memory of the R vector, or with a row order a copy gathered
+  // into buffer.
+  template <typename ValueType>
+  static const ValueType* row_values(const Column_Data& col, int64_t offset, int64_t length,
+                                     std::shared_ptr<arrow::Buffer>* buffer) {
+    const ValueType* values = static_cast<const ValueType*>(col.values);
+    if (col.rows == nullptr) {
+      return values + offset;
+    }
+    *buffer = allocate_buffer(length * sizeof(ValueType));
+    ValueType* out = reinterpret_cast<ValueType*>((*buffer)->mutable_data());
+    const int* rows = col.rows + offset;
+    for (int64_t i = 0; i < length; ++i) {
+      out[i] = values[rows[i] - 1];
+    }
+    return out;
+  }
+
+  // A utf8 array of the strings string_at(i), NA_STRING for the nulls of
+  // bitmap. The offsets are laid out first, so the bytes are copied into one
+  // allocation.
+  template <typename StringAt>
+  static std::shared_ptr<arrow::Array> string_array(int64_t length, StringAt string_at,
+                                                    const std::shared_ptr<arrow::Buffer>& bitmap,
+                                                    int64_t null_count) {
+    std::shared_ptr<arrow::Buffer> offsets = allocate_buffer((length + 1) * sizeof(int32_t));
+    int32_t* value_offset = reinterpret_cast<int32_t*>(offsets->mutable_data());
+    int64_t size = 0;
+    for (int64_t i = 0; i < length; ++i) {
+      value_offset[i] = static_cast<int32_t>(size);
+      SEXP value = string_at(i);
+      if (value != NA_STRING) {
+        size += LENGTH(value);
+      }
+      if (size > std::numeric_limits<int32_t>::max()) {
+        throw std::invalid_argument("Strings of a row group exceed 2GB, use smaller row groups");
+      }
+    }
+    value_offset[length] = static_cast<int32_t>(size);
+    std::shared_ptr<arrow::Buffer> data = allocate_buffer(size);
+    uint8_t* bytes = data->mutable_data();
+    for (int64_t i = 0; i < length; ++i) {
+      SEXP value = string_at(i);
+      if (value != NA_STRING) {
+        std::memcpy(bytes + value_offset[i], CHAR(value), value_offset[i + 1] - value_offset[i]);
+      }
+    }
+    return arrow::MakeArray(arrow::ArrayData::Make(arrow::utf8(), length, {bitmap, offsets, data}, null_count));
+  }
+
+  // Converts the rows [offset, offset + length) of a column. Runs on the
+  // workers, so it only reads the memory of the R vectors.
+  static std::shared_ptr<arrow::Array> make_array(const Column_Data& col, int64_t offset, int64_t length) {
+      std::shared_ptr<arrow::Buffer> gathered;
+      switch(col.type) {
+      case Type::type::TIMESTAMP: {
+        // nanotime and integer64 keep the int64 in the bits of the doubles.
+        const int64_t* values = row_values<int64_t>(col, offset, length, &gathered);
+        return wrap_vector(arrow::timestamp(arrow::TimeUnit::NANO), values, length, is_na_int64, gathered);
+      }
+      case Type::type::INT32: {
+        const int32_t* values = row_values<int32_t>(col, offset, length, &gathered);
+        return wrap_vector(arrow::int32(), values, length,
+            [](int32_t x) { return x == NA_INTEGER; }, gathered);
       }
-        break;
       case Type::type::INT64: {
-        NumericVector nv = m_df[index];
-        arrow::Int64Builder builder;
-        std::vector<int64_t> i64vec(nv.size());
-        std::vector<bool> is_valid(nv.size(), true);
-        for (int i = 0; i < nv.size(); ++i) {
-          if( nv[i] < 0 && nv[i] == -0) {
-            is_valid[i] = false;
-          }
-          int64_t x = 0;
-          memcpy(&x, &nv[i], sizeof(double));
-          i64vec[i] = x;
-        }
-        PARQUET_THROW_NOT_OK(builder.AppendValues(i64vec, is_valid));
-        std::shared_ptr<arrow::Array> ary;
-        PARQUET_THROW_NOT_OK(builder.Finish(&ary));
-        m_table_arrays.push_back(ary);
-        m_table_fields.emplace_back(arrow::field(m_col_names[index], arrow::int64()));
+        const int64_t* values = row_values<int64_t>(col, offset, length, &gathered);
+        return wrap_vector(arrow::int64(), values, length, is_na_int64, gathered);
       }
-        break;
       case Type::type::DOUBLE: {
-        NumericVector nv = m_df[index];
-        std::vector<bool> is_valid(nv.size(), true);
-        for(int i = 0; i < nv.size(); ++i) {
-          if(NumericVector::is_na(nv[i])) {
-            is_valid[i] = false;
-          }
-        }
-        std::vector<double> dvec = as<std::vector<double>>(nv);
-        arrow::DoubleBuilder builder;
-        PARQUET_THROW_NOT_OK(builder.AppendValues(dvec, is_valid));
-        std::shared_ptr<arrow::Array> ary;
-        PARQUET_THROW_NOT_OK(builder.Finish(&ary));
-        m_table_arrays.push_back(ary);
-        m_table_fields.emplace_back(arrow::field(m_col_names[index], arrow::float64()));
-        break;
+        const double* values = row_values<double>(col, offset, length, &gathered);
+        return wrap_vector(arrow::float64(), values, length,
+            [](double x) { return std::isnan(x); }, gathered);
       }
       case Type::type::STRING: {
-        CharacterVector cv = m_df[index];
-        arrow::StringBuilder builder;
-        std::shared_ptr<arrow::Array> ary;
-        std::vector<std::string> svec = as<std::vector<std::string>>(cv);
-        uint8_t is_valid[cv.size()];
-        for (int i = 0; i < cv.size(); ++i) {
-          if (CharacterVector::is_na(cv[i])) {
-            is_valid[i] = 0;
-          }else{
-            is_valid[i] = 1;
-          }
-        }
-        PARQUET_THROW_NOT_OK(builder.AppendValues(svec, is_valid));
-        PARQUET_THROW_NOT_OK(builder.Finish(&ary));
-        m_table_arrays.push_back(ary);
-        m_table_fields.emplace_back(arrow::field(m_col_names[index],  arrow::utf8()));
+        const SEXP* values = row_values<SEXP>(col, offset, length, &gathered);
+        std::shared_ptr<arrow::Buffer> bitmap;
+        int64_t null_count = make_validity(values, length, [](SEXP x) { return x == NA_STRING; }, &bitmap);
+        return string_array(length, [values](int64_t i) { return values[i]; }, bitmap, null_count);
+      }
+      case Type::type::DICTIONARY: {
+        // Factor codes are 1-based indices into the levels. The bytes of the
+        // levels are copied per row, no string is made in R.
+        const int32_t* values = row_values<int32_t>(col, offset, length, &gathered);
+        const SEXP* levels = col.levels;
+        std::shared_ptr<arrow::Buffer> bitmap;
+        int64_t null_count = make_validity(values, length, [](int32_t x) { return x == NA_INTEGER; }, &bitmap);
+        return string_array(length, [values, levels](int64_t i) {
+          return values[i] == NA_INTEGER ? NA_STRING : levels[values[i] - 1];
+        }, bitmap, null_count);
       }
-        break;
       case Type::type::BOOL: {
-        LogicalVector lv = m_df[index];
-        arrow::BooleanBuilder builder;
-        std::vector<bool> is_valid(lv.size(), true);
-        for(int i = 0; i < lv.size(); ++i) {
-          if(LogicalVector::is_na(lv[i])) {
-           is_valid[i] = false;
-          }
-        }
-        std::vector<bool> bvec= as<std::vector<bool>>(lv);
-        PARQUET_THROW_NOT_OK(builder.AppendValues(bvec, is_valid));
-        std::shared_ptr<arrow::Array> ary;
-        PARQUET_THROW_NOT_OK(builder.Finish(&ary));
-        m_table_arrays.push_back(ary);
-        m_table_fields.emplace_back(arrow::field(m_col_names[index], arrow::boolean()));
+        // Arrow booleans are bits, packed the same way as the validity.
+        const int* values = row_values<int>(col, offset, length, &gathered);
+        std::shared_ptr<arrow::Buffer> bitmap;
+        int64_t null_count = make_validity(values, length, [](int x) { return x == NA_LOGICAL; }, &bitmap);
+        std::shared_ptr<arrow::Buffer> data = allocate_buffer(arrow::BitUtil::BytesForBits(length));
+        pack_bits(values, length, [](int x) { return x != 0; }, data->mutable_data());
+        return arrow::MakeArray(arrow::ArrayData::Make(arrow::boolean(), length, {bitmap, data}, null_count));
       }
-        break;
+      default:
+        throw std::invalid_argument("Unknown parquet data type");
       }
-    }
-    std::shared_ptr<arrow::Schema> schema = arrow::schema(m_table_fields);
-    std::shared_ptr<arrow::Table>  t = arrow::Table::Make(schema, m_table_arrays);
-    std::shared_ptr<arrow::io::FileOutputStream> outfile;
-    PARQUET_THROW_NOT_OK(arrow::io::FileOutputStream::Open(m_filename, &outfile));
-    PARQUET_THROW_NOT_OK(parquet::arrow::WriteTable(*t, arrow::default_memory_pool(), outfile, m_rows_per_group));
   }
 
-private:
-  DataFrame &m_df;
   std::string m_filename;
   std::vector<std::string> m_col_types;
   std::vector<int> m_col_idx;
   int m_rows_per_group;
+  int m_threads;
+  List m_options;
   int m_verbose;
-  std::vector<std::shared_ptr<arrow::Array>> m_table_arrays;
+  std::vector<Type::type> m_col_arrow_types;
   std::vector<std::shared_ptr<arrow::Field>> m_table_fields;
   std::vector<std::string> m_col_names;
   std::set<int> m_col_idx_set;
   int m_cols;
-  int m_rows;
-  int m_row_groups;
-  int m_row_remainder;
+  int64_t m_rows;
+  int64_t m_row_groups;
+  bool m_failed;
   std::shared_ptr<::arrow::io::FileOutputStream> m_out_file;
+  std::unique_ptr<parquet::arrow::FileWriter> m_file_writer;
+  std::unique_ptr<Profile> m_profile;
   static const std::unordered_map<std::string, arrow::Type::type> m_parquet_type_map;
+  static const std::unordered_map<std::string, parquet::Compression::type> m_compression_map;
+
+  // NA of integer64 and nanotime.
+  static bool is_na_int64(int64_t x) {
+    return x == std::numeric_limits<int64_t>::min();
+  }
 }; // class Rparquet_Writer
 const std::unordered_map<std::string, arrow::Type::type>
 Rparquet_Writer::m_parquet_type_map = {{"integer", Type::type::INT32},
@@ -223,18 +633,254 @@ Rparquet_Writer::m_parquet_type_map = {{"integer", Type::type::INT32},
                                       {"numeric", Type::type::DOUBLE},
                                       {"character", Type::type::STRING},
                                       {"logical", Type::type::BOOL},
-                                      {"factor", Type::type::STRING}};
+                                      {"factor", Type::type::DICTIONARY}};
+const std::unordered_map<std::string, parquet::Compression::type>
+Rparquet_Writer::m_compression_map = {{"uncompressed", parquet::Compression::UNCOMPRESSED},
+                                      {"snappy", parquet::Compression::SNAPPY},
+                                      {"gzip", parquet::Compression::GZIP},
+                                      {"brotli", parquet::Compression::BROTLI},
+                                      {"lz4", parquet::Compression::LZ4},
+                                      {"zstd", parquet::Compression::ZSTD}};
+
+// Orders the rows of a data frame by key columns, ascending with NA (and NaN)
+// last and ties in the order of the data frame, so the row groups written in
+// that order have tight and non-overlapping min/max statistics on the keys.
+// Strings compare by their bytes, as parquet statistics do, and factors by
+// the bytes of their levels. Slices of the rows are sorted on the workers and
+// then merged pairwise, a round of merges at a time. The data frame is not
+// copied, the writer gathers each row group through the order.
+class Rparquet_Sorter {
+public:
+  Rparquet_Sorter(DataFrame &df, CharacterVector col_types, IntegerVector key_cols, int threads) :
+    m_rows(df.nrows()),
+    m_threads(threads) {
+    std::vector<std::string> types = as<std::vector<std::string>>(col_types);
+    for (auto &idx : key_cols) {
+      if (idx < 1 || idx > df.length()) {
+        stop("Unknown key column %d.", idx);
+      }
+      Sort_Key key;
+      if (!Rparquet_Writer::column_type(types[idx - 1], &key.type)) {
+        stop("Unsupported type %s of key column %d.", types[idx - 1], idx);
+      }
+      key.vec = df[idx - 1];
+      switch (key.type) {
+        case Type::type::TIMESTAMP:
+        case Type::type::INT64:
+        case Type::type::DOUBLE:
+          key.values = REAL(key.vec);
+          break;
+        case Type::type::STRING:
+          key.values = STRING_PTR(key.vec);
+          break;
+        case Type::type::BOOL:
+          key.values = LOGICAL(key.vec);
+          break;
+        default:
+          key.values = INTEGER(key.vec);
+          break;
+      }
+      if (key.type == Type::type::DICTIONARY) {
+        level_ranks(key);
+      }
+      m_keys.push_back(std::move(key));
+    }
+  }
+
+  // The 1-based rows in sorted order.
+  IntegerVector order() {
+    std::vector<int>& order = m_order;
+    order.resize(m_rows);
+    std::iota(order.begin(), order.end(), 0);
+    auto less = [this](int a, int b) {
+      for (size_t k = 0; k < m_keys.size(); ++k) {
+        int c = compare(m_keys[k], a, b);
+        if (c != 0) {
+          return c < 0;
+        }
+      }
+      return false;
+    };
+    int64_t slices = std::max<int64_t>(1, std::min<int64_t>(m_threads, m_rows / m_min_slice_rows));
+    std::vector<int64_t> bounds;
+    for (int64_t i = 0; i <= slices; ++i) {
+      bounds.push_back(m_rows * i / slices);
+    }
+    std::vector<std::function<void()>> tasks;
+    for (int64_t i = 0; i < slices; ++i) {
+      tasks.push_back([&, i]() { std::stable_sort(order.begin() + bounds[i], order.begin() + bounds[i + 1], less); });
+    }
+    run_tasks(tasks, m_threads);
+    while (bounds.size() > 2) {
+      tasks.clear();
+      std::vector<int64_t> merged;
+      for (size_t i = 0; i + 1 < bounds.size(); i += 2) {
+        merged.push_back(bounds[i]);
+        if (i + 2 < bounds.size()) {
+          tasks.push_back([&, i]() {
+            std::inplace_merge(order.begin() + bounds[i], order.begin() + bounds[i + 1], order.begin() + bounds[i + 2],
+                               less);
+          });
+        }
+      }
+      merged.push_back(bounds.back());
+      run_tasks(tasks, m_threads);
+      bounds.swap(merged);
+    }
+    IntegerVector rows(m_rows);
+    for (int64_t i = 0; i < m_rows; ++i) {
+      rows[i] = order[i] + 1;
+    }
+    return rows;
+  }
+
+  // The 1-based positions in the order, after order(), where the values of
+  // the first keys change, starting with 1: the partitions of those keys.
+  IntegerVector partition_starts(int keys) {
+    std::vector<int> starts;
+    for (int64_t i = 0; i < m_rows; ++i) {
+      bool start = i == 0;
+      for (int k = 0; k < keys && !start; ++k) {
+        start = compare(m_keys[k], m_order[i - 1], m_order[i]) != 0;
+      }
+      if (start) {
+        starts.push_back(i + 1);
+      }
+    }
+    return wrap(starts);
+  }
+
+private:
+  struct Sort_Key {
+    Type::type       type;
+    RObject          vec;
+    const void*      values;
+    std::vector<int> ranks;
+  };
+
+  // Ranks the levels of a factor by their bytes, so the codes compare as
+  // the strings written for them.
+  static void level_ranks(Sort_Key& key) {
+    CharacterVector levels = key.vec.attr("levels");
+    std::vector<int> by_bytes(levels.size());
+    std::iota(by_bytes.begin(), by_bytes.end(), 0);
+    std::stable_sort(by_bytes.begin(), by_bytes.end(), [&](int a, int b) {
+      return std::strcmp(CHAR(STRING_ELT(levels, a)), CHAR(STRING_ELT(levels, b))) < 0;
+    });
+    key.ranks.assign(levels.size() + 1, 0);
+    for (size_t i = 0; i < by_bytes.size(); ++i) {
+      key.ranks[by_bytes[i] + 1] = i;
+    }
+  }
+
+  template <typename ValueType>
+  static int compare_values(ValueType a, ValueType b, bool a_na, bool b_na) {
+    if (a_na || b_na) {
+      return a_na == b_na ? 0 : (a_na ? 1 : -1);
+    }
+    return a < b ? -1 : (b < a ? 1 : 0);
+  }
+
+  // Runs on the workers, it only reads the memory of the R vectors.
+  static int compare(const Sort_Key& key, int a, int b) {
+    switch (key.type) {
+      case Type::type::TIMESTAMP:
+      case Type::type::INT64: {
+        const int64_t* values = static_cast<const int64_t*>(key.values);
+        return compare_values(values[a], values[b], values[a] == std::numeric_limits<int64_t>::min(),
+                              values[b] == std::numeric_limits<int64_t>::min());
+      }
+      case Type::type::DOUBLE: {
+        const double* values = static_cast<const double*>(key.values);
+        return compare_values(values[a], values[b], std::isnan(values[a]), std::isnan(values[b]));
+      }
+      case Type::type::STRING: {
+        const SEXP* values = static_cast<const SEXP*>(key.values);
+        if (values[a] == values[b]) {
+          return 0;
+        }
+        if (values[a] == NA_STRING || values[b] == NA_STRING) {
+          return values[a] == NA_STRING ? 1 : -1;
+        }
+        return std::strcmp(CHAR(values[a]), CHAR(values[b]));
+      }
+      case Type::type::DICTIONARY: {
+        const int* values = static_cast<const int*>(key.values);
+        return compare_values(values[a] == NA_INTEGER ? 0 : key.ranks[values[a]],
+                              values[b] == NA_INTEGER ? 0 : key.ranks[values[b]],
+                              values[a] == NA_INTEGER, values[b] == NA_INTEGER);
+      }
+      default: {
+        // Integers and logicals, whose NA are the same.
+        const int* values = static_cast<const int*>(key.values);
+        return compare_values(values[a], values[b], values[a] == NA_INTEGER, values[b] == NA_INTEGER);
+      }
+    }
+  }
+
+  static const int64_t m_min_slice_rows = 1 << 16;
+  int64_t               m_rows;
+  int                   m_threads;
+  std::vector<Sort_Key> m_keys;
+  std::vector<int>      m_order;
+};
 } // namespace RParquet
 
 
 // [[Rcpp::export]]
-int write_rparquet(DataFrame &df, std::string filename, CharacterVector col_types, IntegerVector selected_col, int group_rows, int verbose) {
+SEXP write_rparquet(DataFrame &df, std::string filename, CharacterVector col_types, IntegerVector selected_col, int group_rows, int threads, List options, IntegerVector row_order, bool profile, int verbose) {
   try {
-    RParquet::Rparquet_Writer rp_writer(df, filename, col_types, selected_col, group_rows, verbose);
-    rp_writer.init();
-    rp_writer.write_parquet();
+    RParquet::Rparquet_Writer rp_writer(filename, selected_col, group_rows, threads, options, profile, verbose);
+    if (rp_writer.init(df, col_types)) {
+      rp_writer.write_parquet(df, col_types, row_order);
+      rp_writer.close();
+    }
+    if (profile) {
+      return rp_writer.take_profile();
+    }
+  } catch (const std::exception & e) {
+    stop(" Parquet what error: %s", e.what());
+  }
+  return wrap(0);
+}
+
+// [[Rcpp::export]]
+SEXP open_rparquet_writer(std::string filename, IntegerVector selected_col, int group_rows, int threads, List options, bool profile, int verbose) {
+  return XPtr<RParquet::Rparquet_Writer>(new RParquet::Rparquet_Writer(filename, selected_col, group_rows, threads, options, profile, verbose), true);
+}
+
+// [[Rcpp::export]]
+int append_rparquet(SEXP writer, DataFrame &df, CharacterVector col_types) {
+  XPtr<RParquet::Rparquet_Writer> rp_writer(writer);
+  try {
+    if (!rp_writer->is_open() && !rp_writer->init(df, col_types)) {
+      return 1;
+    }
+    rp_writer->write_parquet(df, col_types);
   } catch (const std::exception & e) {
     stop(" Parquet what error: %s", e.what());
   }
   return 0;
 }
+
+// [[Rcpp::export]]
+SEXP close_rparquet_writer(SEXP writer) {
+  XPtr<RParquet::Rparquet_Writer> rp_writer(writer);
+  try {
+    rp_writer->close();
+    SEXP profile = rp_writer->take_profile();
+    if (profile != R_NilValue) {
+      return profile;
+    }
+  } catch (const std::exception & e) {
+    stop(" Parquet what error: %s", e.what());
+  }
+  return wrap(0);
+}
+
+// [[Rcpp::export]]
+List order_rparquet(DataFrame &df, CharacterVector col_types, IntegerVector key_cols, int partition_keys, int threads) {
+  RParquet::Rparquet_Sorter sorter(df, col_types, key_cols, threads);
+  IntegerVector order = sorter.order();
+  return List::create(Named("order") = order, Named("starts") = sorter.partition_starts(partition_keys));
+}
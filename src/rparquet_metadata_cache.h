@@ -0,0 +1,282 @@
+#ifndef RPARQUET_METADATA_CACHE_H
+#define RPARQUET_METADATA_CACHE_H
+
+#include <arrow/api.h>
+#include <parquet/api/reader.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace RParquet {
+
+// The parsed footer of a file with the arrow schema made from it and the
+// statistics of its column chunks, which are decoded on first use.
+class Cached_Metadata {
+public:
+  Cached_Metadata(std::shared_ptr<parquet::FileMetaData> metadata, int64_t size, int64_t mtime) :
+    m_metadata(metadata),
+    m_size(size),
+    m_mtime(mtime),
+    m_stats(metadata->num_row_groups() * metadata->num_columns()),
+    m_stats_loaded(m_stats.size(), false) {
+  }
+
+  const std::shared_ptr<parquet::FileMetaData>& metadata() const {
+    return m_metadata;
+  }
+
+  std::shared_ptr<arrow::Schema> schema() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_schema;
+  }
+
+  void set_schema(std::shared_ptr<arrow::Schema> schema) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_schema == nullptr) {
+      for (auto &field : schema->fields()) {
+        m_decoded_bytes += sizeof(arrow::Field) + sizeof(arrow::TimestampType) + field->name().size();
+      }
+    }
+    m_schema = schema;
+  }
+
+  // Statistics of a column chunk, null when the file has none.
+  std::shared_ptr<parquet::RowGroupStatistics> statistics(int group_idx, int col_idx) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t i = static_cast<size_t>(group_idx) * m_metadata->num_columns() + col_idx;
+    if (!m_stats_loaded[i]) {
+      auto column_chunk = m_metadata->RowGroup(group_idx)->ColumnChunk(col_idx);
+      if (column_chunk->is_stats_set()) {
+        m_stats[i] = column_chunk->statistics();
+        m_decoded_bytes += sizeof(parquet::Int64Statistics);
+        if (m_stats[i]->HasMinMax()) {
+          m_decoded_bytes += m_stats[i]->EncodeMin().size() + m_stats[i]->EncodeMax().size();
+        }
+      }
+      m_stats_loaded[i] = true;
+    }
+    return m_stats[i];
+  }
+
+  int64_t size() const {
+    return m_size;
+  }
+
+  // An estimate of the memory held: the footer bytes, the slots of the
+  // statistics, and the statistics and schema decoded so far.
+  int64_t memory_bytes() const {
+    return m_metadata->size() + m_stats.size() * (sizeof(m_stats[0]) + 1) + m_decoded_bytes;
+  }
+
+  int64_t mtime() const {
+    return m_mtime;
+  }
+
+private:
+  std::shared_ptr<parquet::FileMetaData>                     m_metadata;
+  int64_t                                                    m_size;
+  int64_t                                                    m_mtime;
+  std::mutex                                                 m_mutex;
+  std::shared_ptr<arrow::Schema>                             m_schema;
+  std::vector<std::shared_ptr<parquet::RowGroupStatistics>>  m_stats;
+  std::vector<bool>                                          m_stats_loaded;
+  std::atomic<int64_t>                                       m_decoded_bytes{0};
+};
+
+// Process wide LRU cache of file footers keyed by path. An entry is only
+// returned while the size and modification time of the file are the ones it
+// was read with. The cache is bounded by the total memory_bytes() of its
+// entries. Statistics and schemas decoded after an entry was returned are
+// counted from its next use, or when the entries or used bytes are asked for.
+class Metadata_Cache {
+public:
+  struct Entry_Info {
+    std::string path;
+    int64_t     size;
+    int64_t     mtime;
+    int64_t     footer_size;
+    int64_t     bytes;
+    int64_t     hits;
+  };
+
+  static Metadata_Cache& instance() {
+    static Metadata_Cache cache;
+    return cache;
+  }
+
+  // Size and modification time in nanoseconds of a file, false if it can not
+  // be stat'ed.
+  static bool file_stamp(const std::string& path, int64_t* size, int64_t* mtime) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+      return false;
+    }
+    *size = st.st_size;
+#if defined(__APPLE__)
+    *mtime = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+    *mtime = static_cast<int64_t>(st.st_mtime) * 1000000000;
+#else
+    *mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return true;
+  }
+
+  // The entry of the file if it is still current, otherwise null.
+  std::shared_ptr<Cached_Metadata> get(const std::string& path, int64_t size, int64_t mtime) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_index.find(path);
+    if (it == m_index.end()) {
+      m_misses++;
+      return nullptr;
+    }
+    if (it->second->entry->size() != size || it->second->entry->mtime() != mtime) {
+      erase(it->second);
+      m_misses++;
+      return nullptr;
+    }
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+    it->second->hits++;
+    m_hits++;
+    std::shared_ptr<Cached_Metadata> entry = it->second->entry;
+    recount(*it->second);
+    evict();
+    return entry;
+  }
+
+  void put(const std::string& path, std::shared_ptr<Cached_Metadata> entry) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_index.find(path);
+    if (it != m_index.end()) {
+      erase(it->second);
+    }
+    int64_t bytes = entry->memory_bytes();
+    if (bytes > m_capacity) {
+      return;
+    }
+    m_lru.push_front(Node{path, entry, bytes, 0});
+    m_index[path] = m_lru.begin();
+    m_used += bytes;
+    evict();
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_lru.clear();
+    m_index.clear();
+    m_used = 0;
+    m_hits = 0;
+    m_misses = 0;
+  }
+
+  // Sets the bound on the total bytes, evicting as needed.
+  void set_capacity(int64_t capacity) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_capacity = capacity;
+    recount_all();
+  }
+
+  // Entries from the most to the least recently used.
+  std::vector<Entry_Info> entries() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    recount_all();
+    std::vector<Entry_Info> result;
+    for (auto &node : m_lru) {
+      result.push_back(Entry_Info{node.path, node.entry->size(), node.entry->mtime(),
+                                  node.entry->metadata()->size(), node.bytes, node.hits});
+    }
+    return result;
+  }
+
+  int64_t capacity() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_capacity;
+  }
+
+  int64_t used() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    recount_all();
+    return m_used;
+  }
+
+  int64_t hits() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_hits;
+  }
+
+  int64_t misses() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_misses;
+  }
+
+private:
+  struct Node {
+    std::string                      path;
+    std::shared_ptr<Cached_Metadata> entry;
+    int64_t                          bytes;
+    int64_t                          hits;
+  };
+
+  Metadata_Cache() : m_capacity(64 << 20), m_used(0), m_hits(0), m_misses(0) {
+  }
+
+  void erase(std::list<Node>::iterator node) {
+    m_used -= node->bytes;
+    m_index.erase(node->path);
+    m_lru.erase(node);
+  }
+
+  // Counts what was decoded in the entry of node since it was last counted.
+  void recount(Node& node) {
+    int64_t bytes = node.entry->memory_bytes();
+    m_used += bytes - node.bytes;
+    node.bytes = bytes;
+  }
+
+  void recount_all() {
+    for (auto &node : m_lru) {
+      recount(node);
+    }
+    evict();
+  }
+
+  // Drops the least recently used entries until the bound holds.
+  void evict() {
+    while (m_used > m_capacity) {
+      erase(std::prev(m_lru.end()));
+    }
+  }
+
+  std::mutex                                                  m_mutex;
+  std::list<Node>                                             m_lru;
+  std::unordered_map<std::string, std::list<Node>::iterator>  m_index;
+  int64_t                                                     m_capacity;
+  int64_t                                                     m_used;
+  int64_t                                                     m_hits;
+  int64_t                                                     m_misses;
+};
+
+// The footer of a file from the cache, or read from the file and cached.
+inline std::shared_ptr<Cached_Metadata> cached_metadata(const std::string& path) {
+  int64_t size = 0;
+  int64_t mtime = 0;
+  if (!Metadata_Cache::file_stamp(path, &size, &mtime)) {
+    throw parquet::ParquetException("Can not stat file " + path);
+  }
+  std::shared_ptr<Cached_Metadata> entry = Metadata_Cache::instance().get(path, size, mtime);
+  if (entry == nullptr) {
+    std::unique_ptr<parquet::ParquetFileReader> parquet_reader = parquet::ParquetFileReader::OpenFile(path, false);
+    entry = std::make_shared<Cached_Metadata>(parquet_reader->metadata(), size, mtime);
+    Metadata_Cache::instance().put(path, entry);
+  }
+  return entry;
+}
+
+} // namespace RParquet
+
+#endif // RPARQUET_METADATA_CACHE_H
@@ -0,0 +1,147 @@
+#ifndef RPARQUET_PROFILE_H
+#define RPARQUET_PROFILE_H
+
+#include <arrow/api.h>
+#include <Rcpp.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace RParquet {
+
+// Forwards to the arrow default pool, counting the bytes allocated through
+// it and their peak since the last reset_peak. The default pool only has a
+// peak since the package was loaded.
+class Peak_Memory_Pool : public arrow::MemoryPool {
+public:
+  arrow::Status Allocate(int64_t size, uint8_t** out) override {
+    RETURN_NOT_OK(arrow::default_memory_pool()->Allocate(size, out));
+    grow(size);
+    return arrow::Status::OK();
+  }
+
+  arrow::Status Reallocate(int64_t old_size, int64_t new_size, uint8_t** ptr) override {
+    RETURN_NOT_OK(arrow::default_memory_pool()->Reallocate(old_size, new_size, ptr));
+    grow(new_size - old_size);
+    return arrow::Status::OK();
+  }
+
+  void Free(uint8_t* buffer, int64_t size) override {
+    arrow::default_memory_pool()->Free(buffer, size);
+    m_bytes -= size;
+  }
+
+  int64_t bytes_allocated() const override {
+    return m_bytes;
+  }
+
+  int64_t max_memory() const override {
+    return m_peak;
+  }
+
+  // Starts a new peak from the bytes allocated now, which are returned.
+  int64_t reset_peak() {
+    int64_t bytes = m_bytes;
+    m_peak = bytes;
+    return bytes;
+  }
+
+private:
+  void grow(int64_t size) {
+    int64_t bytes = m_bytes += size;
+    int64_t peak = m_peak;
+    while (bytes > peak && !m_peak.compare_exchange_weak(peak, bytes)) {
+    }
+  }
+
+  std::atomic<int64_t> m_bytes{0};
+  std::atomic<int64_t> m_peak{0};
+};
+
+// The pool of all the arrow allocations of the package, never destroyed as
+// buffers may outlive the statics.
+inline Peak_Memory_Pool* memory_pool() {
+  static Peak_Memory_Pool* pool = new Peak_Memory_Pool();
+  return pool;
+}
+
+// Opt-in timings and byte counts of the phases of a read or a write, per
+// column and row group where they apply. Entries may be added by the
+// workers, the data frame is made on the main thread.
+class Profile {
+public:
+  typedef std::chrono::steady_clock::time_point Time_Point;
+
+  static Time_Point now() {
+    return std::chrono::steady_clock::now();
+  }
+
+  Profile() : m_pool_start(memory_pool()->reset_peak()) {
+  }
+
+  static double since(Time_Point start) {
+    return std::chrono::duration<double>(now() - start).count();
+  }
+
+  // col_idx and group_idx are -1 for the phases of the whole file, seconds,
+  // bytes and rows are negative when not measured.
+  void add(const char* phase, int col_idx, int group_idx, double seconds, int64_t bytes = -1, int64_t rows = -1) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.push_back(Entry{phase, col_idx, group_idx, seconds, bytes, rows});
+  }
+
+  // The entries added since the last call as a data frame, col_idx indexing
+  // col_names. A last row holds the peak bytes of the arrow memory pool above
+  // those allocated when the profile was made or last taken.
+  Rcpp::DataFrame take(const std::vector<std::string>& col_names) {
+    std::vector<Entry> entries;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      entries.swap(m_entries);
+    }
+    int64_t pool_peak = memory_pool()->max_memory() - m_pool_start;
+    m_pool_start = memory_pool()->reset_peak();
+    entries.push_back(Entry{"pool_peak", -1, -1, -1, std::max<int64_t>(pool_peak, 0), -1});
+    size_t size = entries.size();
+    Rcpp::CharacterVector phase(size);
+    Rcpp::CharacterVector column(size);
+    Rcpp::IntegerVector row_group(size);
+    Rcpp::NumericVector seconds(size);
+    Rcpp::NumericVector bytes(size);
+    Rcpp::NumericVector rows(size);
+    for (size_t i = 0; i < size; ++i) {
+      const Entry& e = entries[i];
+      phase[i] = e.phase;
+      column[i] = e.col_idx < 0 ? NA_STRING : Rf_mkCharCE(col_names[e.col_idx].c_str(), CE_UTF8);
+      row_group[i] = e.group_idx < 0 ? NA_INTEGER : e.group_idx + 1;
+      seconds[i] = e.seconds < 0 ? NA_REAL : e.seconds;
+      bytes[i] = e.bytes < 0 ? NA_REAL : e.bytes;
+      rows[i] = e.rows < 0 ? NA_REAL : e.rows;
+    }
+    return Rcpp::DataFrame::create(Rcpp::Named("phase") = phase, Rcpp::Named("column") = column,
+                                   Rcpp::Named("row_group") = row_group, Rcpp::Named("seconds") = seconds,
+                                   Rcpp::Named("bytes") = bytes, Rcpp::Named("rows") = rows,
+                                   Rcpp::Named("stringsAsFactors") = false);
+  }
+
+private:
+  struct Entry {
+    const char* phase;
+    int         col_idx;
+    int         group_idx;
+    double      seconds;
+    int64_t     bytes;
+    int64_t     rows;
+  };
+
+  std::mutex         m_mutex;
+  std::vector<Entry> m_entries;
+  int64_t            m_pool_start;
+};
+
+} // namespace RParquet
+
+#endif // RPARQUET_PROFILE_H
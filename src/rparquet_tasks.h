@@ -0,0 +1,158 @@
+#ifndef RPARQUET_TASKS_H
+#define RPARQUET_TASKS_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace RParquet {
+// Runs the tasks on up to "threads" worker threads. Tasks must not touch the R
+// API; the first exception thrown by a task is rethrown on the calling thread.
+inline void run_tasks(const std::vector<std::function<void()>>& tasks, int threads) {
+  int workers = std::min<int>(threads, tasks.size());
+  if (workers <= 1) {
+    for (auto &task : tasks) {
+      task();
+    }
+    return;
+  }
+  std::atomic<size_t> next(0);
+  std::vector<std::exception_ptr> errors(workers);
+  std::vector<std::thread> pool;
+  for (int w = 0; w < workers; ++w) {
+    pool.emplace_back([&, w]() {
+      try {
+        for (size_t i = next++; i < tasks.size(); i = next++) {
+          tasks[i]();
+        }
+      } catch (...) {
+        errors[w] = std::current_exception();
+        next = tasks.size();
+      }
+    });
+  }
+  for (auto &t : pool) {
+    t.join();
+  }
+  for (auto &e : errors) {
+    if (e) {
+      std::rethrow_exception(e);
+    }
+  }
+}
+
+// Runs tasks in order on background threads while the calling thread takes
+// their results in the same order, so that producing the next results
+// overlaps with consuming the current one. At most depth results are started
+// ahead of the consumer. The costs of those results, known before they are
+// started, stay within budget; a result over budget on its own is only
+// started once the consumer has taken everything before it. Tasks must not
+// touch the R API. The first exception thrown by a task is rethrown by
+// take().
+template <typename T>
+class Task_Pipeline {
+public:
+  Task_Pipeline(std::vector<std::function<T()>> tasks, std::vector<int64_t> costs, int threads, int depth,
+                int64_t budget) :
+    m_tasks(std::move(tasks)),
+    m_costs(std::move(costs)),
+    m_results(m_tasks.size()),
+    m_done(m_tasks.size(), false),
+    m_depth(std::max(depth, 1)),
+    m_budget(budget) {
+    int workers = std::min<int>({std::max(threads, 1), m_depth, static_cast<int>(m_tasks.size())});
+    for (int w = 0; w < workers; ++w) {
+      m_workers.emplace_back([this]() { work(); });
+    }
+  }
+
+  ~Task_Pipeline() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_cond.notify_all();
+    for (auto &t : m_workers) {
+      t.join();
+    }
+  }
+
+  // The result of the next task, waiting for it if needed.
+  T take() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    size_t i = m_next_take;
+    m_cond.wait(lock, [&]() { return m_done[i] || m_error; });
+    if (m_error) {
+      std::rethrow_exception(m_error);
+    }
+    T result = std::move(m_results[i]);
+    m_results[i] = T();
+    m_next_take++;
+    m_cost_ahead -= m_costs[i];
+    lock.unlock();
+    m_cond.notify_all();
+    return result;
+  }
+
+private:
+  bool can_start() const {
+    if (m_next_task == m_tasks.size() || m_next_task - m_next_take >= static_cast<size_t>(m_depth)) {
+      return false;
+    }
+    return m_next_task == m_next_take || m_cost_ahead + m_costs[m_next_task] <= m_budget;
+  }
+
+  void work() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+      m_cond.wait(lock, [&]() { return m_stop || m_error || m_next_task == m_tasks.size() || can_start(); });
+      if (m_stop || m_error || m_next_task == m_tasks.size()) {
+        return;
+      }
+      size_t i = m_next_task++;
+      m_cost_ahead += m_costs[i];
+      lock.unlock();
+      T result = T();
+      std::exception_ptr error;
+      try {
+        result = m_tasks[i]();
+      } catch (...) {
+        error = std::current_exception();
+      }
+      lock.lock();
+      if (error) {
+        if (!m_error) {
+          m_error = error;
+        }
+      } else {
+        m_results[i] = std::move(result);
+        m_done[i] = true;
+      }
+      m_cond.notify_all();
+    }
+  }
+
+  std::vector<std::function<T()>> m_tasks;
+  std::vector<int64_t>            m_costs;
+  std::vector<T>                  m_results;
+  std::vector<bool>               m_done;
+  int                             m_depth;
+  int64_t                         m_budget;
+  size_t                          m_next_task = 0;
+  size_t                          m_next_take = 0;
+  int64_t                         m_cost_ahead = 0;
+  bool                            m_stop = false;
+  std::exception_ptr              m_error;
+  std::mutex                      m_mutex;
+  std::condition_variable         m_cond;
+  std::vector<std::thread>        m_workers;
+};
+} // namespace RParquet
+
+#endif // RPARQUET_TASKS_H
@@ -0,0 +1,83 @@
+#ifndef RPARQUET_UNWIND_H
+#define RPARQUET_UNWIND_H
+
+#include <Rcpp.h>
+#include <Rversion.h>
+#include <csetjmp>
+
+namespace RParquet {
+
+// R leaves a failed allocation, an error or an interrupt with a longjmp,
+// which would skip the destructors of the C++ frames in between: worker
+// threads left running on objects of those frames, files left open. The R
+// calls made while such objects live go through unwind_protect(), which turns
+// the jump into an R_Unwind exception; once the C++ frames are unwound the
+// jump is resumed by continue_unwind(). Main thread only.
+struct R_Unwind {
+  SEXP token;
+};
+
+// The continuation token of the jumps, made once and kept for the session.
+inline SEXP unwind_token() {
+#if R_VERSION >= R_Version(3, 5, 0)
+  static SEXP token = nullptr;
+  if (token == nullptr) {
+    token = R_MakeUnwindCont();
+    R_PreserveObject(token);
+  }
+  return token;
+#else
+  return R_NilValue;
+#endif
+}
+
+// Runs f, which calls the R API. The jump out of f skips f itself, so f must
+// not own objects with non-trivial destructors. Before R 3.5 there is no way
+// to catch the jump and f runs unprotected.
+template <typename FuncType>
+inline void unwind_protect(FuncType f) {
+#if R_VERSION >= R_Version(3, 5, 0)
+  SEXP token = unwind_token();
+  std::jmp_buf jump;
+  if (setjmp(jump)) {
+    throw R_Unwind{token};
+  }
+  R_UnwindProtect(
+    [](void* data) {
+      (*static_cast<FuncType*>(data))();
+      return R_NilValue;
+    }, &f,
+    [](void* jump, Rboolean jumping) {
+      if (jumping) {
+        std::longjmp(*static_cast<std::jmp_buf*>(jump), 1);
+      }
+    }, &jump, token);
+#else
+  f();
+#endif
+}
+
+// Resumes the jump of an R_Unwind caught once the C++ frames are gone.
+[[noreturn]] inline void continue_unwind(const R_Unwind& unwind) {
+#if R_VERSION >= R_Version(3, 5, 0)
+  R_ContinueUnwind(unwind.token);
+#endif
+  Rf_error("Unexpected R jump");
+}
+
+// Runs f, the body of an export, resuming the jump of an R_Unwind it throws
+// after its frames are unwound.
+template <typename FuncType>
+inline auto unwind_boundary(FuncType f) -> decltype(f()) {
+  SEXP token;
+  try {
+    return f();
+  } catch (R_Unwind& e) {
+    token = e.token;
+  }
+  continue_unwind(R_Unwind{token});
+}
+
+}
+
+#endif // RPARQUET_UNWIND_H